@@ -0,0 +1,1208 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+// cost of visiting a node relative to intersecting a triangle
+constexpr float BVH_TRAVERSAL_COST = 1.0f;
+// leaves are split if they hold more triangles than this, whatever the cost
+constexpr unsigned int BVH_MAX_LEAF_SIZE = 8;
+// bits of the Morton codes per axis, three axes fit in 32 bits
+constexpr unsigned int BVH_MORTON_BITS = 10;
+// bits of the codes sorted by each radix sort pass, and the buckets they need
+constexpr unsigned int BVH_RADIX_BITS = 10;
+constexpr unsigned int BVH_RADIX_BUCKETS = 1u << BVH_RADIX_BITS;
+// spatial splits are tried where the object split's children overlap by more
+// than this part of the root's area, deeper and smaller nodes are not worth it
+constexpr float BVH_SPATIAL_OVERLAP = 1e-4f;
+
+AABB::AABB()
+    : lower(std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::infinity()),
+    upper(-std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity()) {}
+
+void AABB::Extend(const Cartesian3& point) {
+    lower = Cartesian3(std::min(lower.x, point.x), std::min(lower.y, point.y),
+        std::min(lower.z, point.z));
+    upper = Cartesian3(std::max(upper.x, point.x), std::max(upper.y, point.y),
+        std::max(upper.z, point.z));
+}
+
+// the corners are taken separately, so extending by an empty box changes nothing
+void AABB::Extend(const AABB& other) {
+    lower = Cartesian3(std::min(lower.x, other.lower.x), std::min(lower.y, other.lower.y),
+        std::min(lower.z, other.lower.z));
+    upper = Cartesian3(std::max(upper.x, other.upper.x), std::max(upper.y, other.upper.y),
+        std::max(upper.z, other.upper.z));
+}
+
+Cartesian3 AABB::Centre() const {
+    return (lower + upper) * 0.5f;
+}
+
+float AABB::SurfaceArea() const {
+    Cartesian3 extent = upper - lower;
+    // an empty box has no area
+    if ((extent.x < 0.0f) || (extent.y < 0.0f) || (extent.z < 0.0f))
+        return 0.0f;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+unsigned int AABB::LargestAxis() const {
+    Cartesian3 extent = upper - lower;
+    if ((extent.x >= extent.y) && (extent.x >= extent.z))
+        return 0;
+    return (extent.y >= extent.z) ? 1 : 2;
+}
+
+// slab test, NaNs from 0 * inf when the ray lies in a slab plane are discarded
+// by the min/max ordering
+bool AABB::Intersect(const Ray& ray, const Cartesian3& invDir,
+    float tMin, float tMax, float& tEntry) const {
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float tNear = (lower[axis] - ray.origin_[axis]) * invDir[axis];
+        float tFar = (upper[axis] - ray.origin_[axis]) * invDir[axis];
+        if (tNear > tFar)
+            std::swap(tNear, tFar);
+        tMin = tNear > tMin ? tNear : tMin;
+        tMax = tFar < tMax ? tFar : tMax;
+        if (tMin > tMax)
+            return false;
+    }
+    tEntry = tMin;
+    return true;
+}
+
+// the bin a centre falls in along an axis
+static inline unsigned int BinIndex(float centre, float lower, float binScale) {
+    return std::min(BVH_BINS - 1, (unsigned int) ((centre - lower) * binScale));
+}
+
+// spread the lowest 10 bits of a value out to every third bit
+static inline uint32_t SpreadBits(uint32_t value) {
+    value = (value | (value << 16)) & 0x030000ffu;
+    value = (value | (value << 8)) & 0x0300f00fu;
+    value = (value | (value << 4)) & 0x030c30c3u;
+    value = (value | (value << 2)) & 0x09249249u;
+    return value;
+}
+
+// whether a box holds nothing, an empty box has its lower corner above its upper
+static inline bool IsEmpty(const AABB& box) {
+    return (box.lower.x > box.upper.x) || (box.lower.y > box.upper.y) ||
+        (box.lower.z > box.upper.z);
+}
+
+// shrink a box to its part within another, which may leave it empty
+static inline void ClipBox(AABB& box, const AABB& clip) {
+    box.lower = Cartesian3(std::max(box.lower.x, clip.lower.x),
+        std::max(box.lower.y, clip.lower.y), std::max(box.lower.z, clip.lower.z));
+    box.upper = Cartesian3(std::min(box.upper.x, clip.upper.x),
+        std::min(box.upper.y, clip.upper.y), std::min(box.upper.z, clip.upper.z));
+    if (IsEmpty(box))
+        box = AABB();
+}
+
+BVH::Bins::Bins() {
+    std::fill(&counts[0][0], &counts[0][0] + 3 * BVH_BINS, 0u);
+}
+
+// add the bins of another part of the same range
+void BVH::Bins::Merge(const Bins& other) {
+    for (unsigned int axis = 0; axis < 3; axis++)
+        for (unsigned int bin = 0; bin < BVH_BINS; bin++) {
+            bounds[axis][bin].Extend(other.bounds[axis][bin]);
+            counts[axis][bin] += other.counts[axis][bin];
+        }
+}
+
+BVH::SpatialBins::SpatialBins() {
+    std::fill(&entries[0][0], &entries[0][0] + 3 * BVH_BINS, 0u);
+    std::fill(&exits[0][0], &exits[0][0] + 3 * BVH_BINS, 0u);
+}
+
+// build the hierarchy from scratch
+void BVH::Build(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, ThreadPool* pool, BVHBuildMode mode) {
+    if (mode == BVH_BUILD_SPATIAL) {
+        BuildSpatial(vertices, faces, pool);
+        return;
+    }
+
+    // compute the bounds and centres of the triangles once
+    std::vector<BuildPrimitive> buildPrimitives(faces.size());
+    RunSlices(pool, [&](unsigned int slice) {
+        unsigned int last = SliceStart(0, faces.size(), slice + 1, SliceCount(pool));
+        for (unsigned int tri = SliceStart(0, faces.size(), slice, SliceCount(pool));
+            tri < last; tri++) {
+            buildPrimitives[tri].bounds = TriangleBounds(vertices, faces[tri]);
+            buildPrimitives[tri].centre = buildPrimitives[tri].bounds.Centre();
+        }
+    });
+    Build(buildPrimitives, pool, mode);
+}
+
+// build the hierarchy over boxes rather than triangles
+void BVH::Build(const std::vector<AABB>& bounds, ThreadPool* pool, BVHBuildMode mode) {
+    std::vector<BuildPrimitive> buildPrimitives(bounds.size());
+    for (unsigned int prim = 0; prim < bounds.size(); prim++) {
+        buildPrimitives[prim].bounds = bounds[prim];
+        buildPrimitives[prim].centre = bounds[prim].Centre();
+    }
+    Build(buildPrimitives, pool, (mode == BVH_BUILD_SPATIAL) ? BVH_BUILD_SAH : mode);
+}
+
+// build the hierarchy over the primitives' bounds and centres
+void BVH::Build(const std::vector<BuildPrimitive>& buildPrimitives, ThreadPool* pool,
+    BVHBuildMode mode) {
+    nodes.clear();
+    primitives.resize(buildPrimitives.size());
+    std::iota(primitives.begin(), primitives.end(), 0);
+    if (buildPrimitives.empty())
+        return;
+
+    // split the top levels, with every thread for the surface area heuristic
+    // and as a single subtree without a pool
+    std::vector<TopNode> top;
+    std::vector<unsigned int> subtreeRoots;
+    std::vector<uint32_t> codes;
+    if (mode != BVH_BUILD_SAH) {
+        SortMorton(pool, buildPrimitives, codes);
+        BuildLinearTop(codes, top, subtreeRoots, 0, buildPrimitives.size(), 0);
+    }
+    else if (pool != nullptr) {
+        std::vector<unsigned int> scratch(buildPrimitives.size());
+        BuildTop(*pool, buildPrimitives, scratch, top, subtreeRoots, 0,
+            buildPrimitives.size(), 0);
+    }
+    else {
+        top.push_back(TopNode{0, (unsigned int) buildPrimitives.size(), 0, {0, 0}, true});
+        subtreeRoots.push_back(0);
+    }
+
+    // then build the subtrees, a binary tree never has more than 2n - 1 nodes
+    std::vector<std::vector<BVHNode>> subtrees(subtreeRoots.size());
+    auto buildSubtree = [&](unsigned int subtree) {
+        const TopNode& root = top[subtreeRoots[subtree]];
+        subtrees[subtree].reserve(2 * (root.end - root.begin) - 1);
+        if (mode == BVH_BUILD_SAH)
+            BuildRecursive(buildPrimitives, subtrees[subtree], root.begin, root.end,
+                root.depth);
+        else
+            BuildLinearRecursive(buildPrimitives, codes, subtrees[subtree], root.begin,
+                root.end, root.depth);
+        if (mode == BVH_BUILD_LINEAR_TREELETS)
+            OptimizeTreelets(subtrees[subtree], root.depth);
+    };
+    // the largest first, so the last ones to finish are small
+    std::vector<unsigned int> order(subtreeRoots.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        const TopNode& first = top[subtreeRoots[a]];
+        const TopNode& second = top[subtreeRoots[b]];
+        return (first.end - first.begin) > (second.end - second.begin);
+    });
+    std::atomic<unsigned int> nextSubtree(0);
+    RunSlices(pool, [&](unsigned int) {
+        for (unsigned int task = nextSubtree++; task < order.size(); task = nextSubtree++)
+            buildSubtree(order[task]);
+    });
+
+    // and stitch them under the top levels
+    Flatten(pool, top, subtrees);
+}
+
+// bin the triangles in [begin, end) by their centres
+void BVH::BinRange(const std::vector<BuildPrimitive>& buildPrimitives,
+    unsigned int begin, unsigned int end, const AABB& centreBounds,
+    Bins& bins) const {
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float extent = centreBounds.upper[axis] - centreBounds.lower[axis];
+        // all centres in a plane, nothing to split along this axis
+        if (extent <= 0.0f)
+            continue;
+        float binScale = BVH_BINS / extent;
+        for (unsigned int prim = begin; prim < end; prim++) {
+            const BuildPrimitive& buildPrimitive = buildPrimitives[primitives[prim]];
+            unsigned int bin = BinIndex(buildPrimitive.centre[axis],
+                centreBounds.lower[axis], binScale);
+            bins.bounds[axis][bin].Extend(buildPrimitive.bounds);
+            bins.counts[axis][bin]++;
+        }
+    }
+}
+
+// sweep the bins for the plane with the lowest cost
+BVH::Split BVH::FindSplit(const Bins& bins, const AABB& centreBounds) {
+    Split best{std::numeric_limits<float>::infinity(), 0, 0};
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        if (centreBounds.upper[axis] - centreBounds.lower[axis] <= 0.0f)
+            continue;
+
+        // sweep from the right to get the area and count right of each plane
+        float rightAreas[BVH_BINS];
+        unsigned int rightCounts[BVH_BINS];
+        AABB rightBounds;
+        unsigned int rightCount = 0;
+        for (unsigned int bin = BVH_BINS - 1; bin > 0; bin--) {
+            rightBounds.Extend(bins.bounds[axis][bin]);
+            rightCount += bins.counts[axis][bin];
+            rightAreas[bin] = rightBounds.SurfaceArea();
+            rightCounts[bin] = rightCount;
+        }
+
+        // then from the left, evaluating the heuristic at each plane
+        AABB leftBounds;
+        unsigned int leftCount = 0;
+        for (unsigned int bin = 1; bin < BVH_BINS; bin++) {
+            leftBounds.Extend(bins.bounds[axis][bin - 1]);
+            leftCount += bins.counts[axis][bin - 1];
+            if ((leftCount == 0) || (rightCounts[bin] == 0))
+                continue;
+            float cost = leftCount * leftBounds.SurfaceArea() +
+                rightCounts[bin] * rightAreas[bin];
+            if (cost < best.cost)
+                best = Split{cost, axis, bin};
+        }
+    }
+    return best;
+}
+
+// whether a range is cheaper, or has to be, kept as a leaf. Without a plane
+// every centre coincides and a range too large for a leaf is just halved
+bool BVH::KeepLeaf(const Split& split, const AABB& bounds, unsigned int count) {
+    if (count > BVH_MAX_LEAF_SIZE)
+        return false;
+    if (split.cost == std::numeric_limits<float>::infinity())
+        return true;
+    // compare the split against making a leaf, both relative to the node area
+    float area = bounds.SurfaceArea();
+    float splitCost = BVH_TRAVERSAL_COST + (area > 0.0f ? split.cost / area : 0.0f);
+    return splitCost >= count;
+}
+
+// recursively split the primitives in [begin, end) into the subtree
+unsigned int BVH::BuildRecursive(const std::vector<BuildPrimitive>& buildPrimitives,
+    std::vector<BVHNode>& subtree, unsigned int begin, unsigned int end,
+    unsigned int depth) {
+    // reserve this node, children are created after it
+    unsigned int nodeIndex = subtree.size();
+    subtree.push_back(BVHNode());
+
+    // bounds of the triangles and of their centres
+    AABB bounds, centreBounds;
+    for (unsigned int prim = begin; prim < end; prim++) {
+        bounds.Extend(buildPrimitives[primitives[prim]].bounds);
+        centreBounds.Extend(buildPrimitives[primitives[prim]].centre);
+    }
+    subtree[nodeIndex].bounds = bounds;
+
+    // find the cheapest split plane among the bin boundaries of every axis
+    unsigned int count = end - begin;
+    Split split{std::numeric_limits<float>::infinity(), 0, 0};
+    bool leaf = (count <= BVH_LEAF_SIZE) || (depth >= BVH_MAX_DEPTH - 1);
+    if (!leaf) {
+        Bins bins;
+        BinRange(buildPrimitives, begin, end, centreBounds, bins);
+        split = FindSplit(bins, centreBounds);
+        leaf = KeepLeaf(split, bounds, count);
+    }
+    if (leaf) {
+        subtree[nodeIndex].first = begin;
+        subtree[nodeIndex].count = count;
+        return nodeIndex;
+    }
+
+    unsigned int middle = begin + count / 2;
+    if (split.cost < std::numeric_limits<float>::infinity()) {
+        // move the triangles left of the plane to the front of the range
+        float lowerBound = centreBounds.lower[split.axis];
+        float binScale = BVH_BINS / (centreBounds.upper[split.axis] - lowerBound);
+        middle = std::partition(primitives.begin() + begin, primitives.begin() + end,
+            [&](unsigned int prim) {
+                return BinIndex(buildPrimitives[prim].centre[split.axis],
+                    lowerBound, binScale) < split.bin;
+            }) - primitives.begin();
+    }
+
+    // the first child directly follows, only the second needs to be stored
+    BuildRecursive(buildPrimitives, subtree, begin, middle, depth + 1);
+    unsigned int second = BuildRecursive(buildPrimitives, subtree, middle, end, depth + 1);
+    subtree[nodeIndex].first = second;
+    subtree[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+// split the primitives in [begin, end) with every thread until the ranges are
+// small enough to be subtrees. The ranges here are far larger than any leaf, so
+// they are always split
+unsigned int BVH::BuildTop(ThreadPool& pool,
+    const std::vector<BuildPrimitive>& buildPrimitives,
+    std::vector<unsigned int>& scratch, std::vector<TopNode>& top,
+    std::vector<unsigned int>& subtreeRoots, unsigned int begin,
+    unsigned int end, unsigned int depth) {
+    unsigned int topIndex = top.size();
+    unsigned int count = end - begin;
+    top.push_back(TopNode{begin, end, depth, {0, 0}, false});
+    if ((count <= BVH_PARALLEL_THRESHOLD) || (depth >= BVH_MAX_DEPTH - 1)) {
+        top[topIndex].isSubtree = true;
+        top[topIndex].children[0] = subtreeRoots.size();
+        subtreeRoots.push_back(topIndex);
+        return topIndex;
+    }
+
+    // bounds of the centres, a part per thread. The node's own bounds are
+    // those of its children, which are known once the subtrees are built
+    unsigned int nSlices = pool.Size();
+    std::vector<AABB> sliceCentreBounds(nSlices);
+    pool.Run([&](unsigned int slice) {
+        unsigned int sliceEnd = SliceStart(begin, count, slice + 1, nSlices);
+        for (unsigned int prim = SliceStart(begin, count, slice, nSlices);
+            prim < sliceEnd; prim++)
+            sliceCentreBounds[slice].Extend(buildPrimitives[primitives[prim]].centre);
+    });
+    AABB centreBounds;
+    for (unsigned int slice = 0; slice < nSlices; slice++)
+        centreBounds.Extend(sliceCentreBounds[slice]);
+
+    // then the bins the same way
+    std::vector<Bins> sliceBins(nSlices);
+    pool.Run([&](unsigned int slice) {
+        BinRange(buildPrimitives, SliceStart(begin, count, slice, nSlices),
+            SliceStart(begin, count, slice + 1, nSlices), centreBounds, sliceBins[slice]);
+    });
+    for (unsigned int slice = 1; slice < nSlices; slice++)
+        sliceBins[0].Merge(sliceBins[slice]);
+    Split split = FindSplit(sliceBins[0], centreBounds);
+
+    unsigned int middle = begin + count / 2;
+    if (split.cost < std::numeric_limits<float>::infinity()) {
+        float lowerBound = centreBounds.lower[split.axis];
+        float binScale = BVH_BINS / (centreBounds.upper[split.axis] - lowerBound);
+        auto isLeft = [&](unsigned int prim) {
+            return BinIndex(buildPrimitives[prim].centre[split.axis],
+                lowerBound, binScale) < split.bin;
+        };
+
+        // a stable partition, so the hierarchy does not depend on the number of
+        // threads. Each part counts its triangles left of the plane, which
+        // gives every part where its left and right triangles go
+        std::vector<unsigned int> leftCounts(nSlices);
+        pool.Run([&](unsigned int slice) {
+            unsigned int sliceEnd = SliceStart(begin, count, slice + 1, nSlices);
+            unsigned int leftCount = 0;
+            for (unsigned int prim = SliceStart(begin, count, slice, nSlices);
+                prim < sliceEnd; prim++)
+                leftCount += isLeft(primitives[prim]);
+            leftCounts[slice] = leftCount;
+        });
+        unsigned int nLeft = 0;
+        std::vector<unsigned int> leftStarts(nSlices), rightStarts(nSlices);
+        for (unsigned int slice = 0; slice < nSlices; slice++) {
+            leftStarts[slice] = begin + nLeft;
+            rightStarts[slice] = SliceStart(begin, count, slice, nSlices) - begin - nLeft;
+            nLeft += leftCounts[slice];
+        }
+        middle = begin + nLeft;
+
+        // scatter the triangles into the scratch array, then copy them back
+        pool.Run([&](unsigned int slice) {
+            unsigned int left = leftStarts[slice], right = middle + rightStarts[slice];
+            unsigned int sliceEnd = SliceStart(begin, count, slice + 1, nSlices);
+            for (unsigned int prim = SliceStart(begin, count, slice, nSlices);
+                prim < sliceEnd; prim++) {
+                unsigned int primitive = primitives[prim];
+                scratch[isLeft(primitive) ? left++ : right++] = primitive;
+            }
+        });
+        pool.Run([&](unsigned int slice) {
+            std::copy(scratch.begin() + SliceStart(begin, count, slice, nSlices),
+                scratch.begin() + SliceStart(begin, count, slice + 1, nSlices),
+                primitives.begin() + SliceStart(begin, count, slice, nSlices));
+        });
+    }
+
+    unsigned int first = BuildTop(pool, buildPrimitives, scratch, top, subtreeRoots,
+        begin, middle, depth + 1);
+    unsigned int second = BuildTop(pool, buildPrimitives, scratch, top, subtreeRoots,
+        middle, end, depth + 1);
+    top[topIndex].children[0] = first;
+    top[topIndex].children[1] = second;
+    return topIndex;
+}
+
+// stitch the subtrees under the top levels, depth first. Laying out the top
+// levels places every subtree, so they are then copied in parallel
+void BVH::Flatten(ThreadPool* pool, const std::vector<TopNode>& top,
+    std::vector<std::vector<BVHNode>>& subtrees,
+    std::vector<std::vector<unsigned int>>* subtreePrimitives) {
+    // where each top node goes, the second child is pushed first so the first
+    // is placed directly after its parent. The subtrees' own primitives are
+    // laid out in the same order
+    std::vector<unsigned int> positions(top.size());
+    std::vector<unsigned int> primitiveBases(subtrees.size(), 0);
+    std::vector<unsigned int> stack(1, 0);
+    unsigned int nodeCount = 0, primitiveCount = 0;
+    while (!stack.empty()) {
+        unsigned int topIndex = stack.back();
+        stack.pop_back();
+        positions[topIndex] = nodeCount;
+        if (top[topIndex].isSubtree) {
+            unsigned int subtree = top[topIndex].children[0];
+            nodeCount += subtrees[subtree].size();
+            if (subtreePrimitives != nullptr) {
+                primitiveBases[subtree] = primitiveCount;
+                primitiveCount += (*subtreePrimitives)[subtree].size();
+            }
+        }
+        else {
+            nodeCount++;
+            stack.push_back(top[topIndex].children[1]);
+            stack.push_back(top[topIndex].children[0]);
+        }
+    }
+    nodes.resize(nodeCount);
+    if (subtreePrimitives != nullptr)
+        primitives.resize(primitiveCount);
+
+    // the subtrees' interior nodes point at second children within them, and
+    // their leaves at their own primitives if they have them
+    std::atomic<unsigned int> nextTop(0);
+    RunSlices(pool, [&](unsigned int) {
+        for (unsigned int topIndex = nextTop++; topIndex < top.size(); topIndex = nextTop++) {
+            if (!top[topIndex].isSubtree)
+                continue;
+            std::vector<BVHNode>& subtree = subtrees[top[topIndex].children[0]];
+            unsigned int base = positions[topIndex];
+            unsigned int primitiveBase = primitiveBases[top[topIndex].children[0]];
+            for (unsigned int node = 0; node < subtree.size(); node++) {
+                nodes[base + node] = subtree[node];
+                nodes[base + node].first += subtree[node].IsLeaf() ? primitiveBase : base;
+            }
+            std::vector<BVHNode>().swap(subtree);
+            if (subtreePrimitives != nullptr) {
+                std::vector<unsigned int>& own = (*subtreePrimitives)[top[topIndex].children[0]];
+                std::copy(own.begin(), own.end(), primitives.begin() + primitiveBase);
+                std::vector<unsigned int>().swap(own);
+            }
+        }
+    });
+
+    // then bound the top levels by their children, which always come later
+    for (unsigned int topIndex = top.size(); topIndex-- > 0; ) {
+        if (top[topIndex].isSubtree)
+            continue;
+        BVHNode& node = nodes[positions[topIndex]];
+        node.bounds = nodes[positions[top[topIndex].children[0]]].bounds;
+        node.bounds.Extend(nodes[positions[top[topIndex].children[1]]].bounds);
+        node.first = positions[top[topIndex].children[1]];
+        node.count = 0;
+    }
+}
+
+// sort the primitives along a Morton curve through the centres
+void BVH::SortMorton(ThreadPool* pool,
+    const std::vector<BuildPrimitive>& buildPrimitives,
+    std::vector<uint32_t>& codes) {
+    unsigned int count = primitives.size(), nSlices = SliceCount(pool);
+
+    // the codes place the centres on a grid over their bounds
+    std::vector<AABB> sliceCentreBounds(nSlices);
+    RunSlices(pool, [&](unsigned int slice) {
+        unsigned int sliceEnd = SliceStart(0, count, slice + 1, nSlices);
+        for (unsigned int prim = SliceStart(0, count, slice, nSlices); prim < sliceEnd; prim++)
+            sliceCentreBounds[slice].Extend(buildPrimitives[primitives[prim]].centre);
+    });
+    AABB centreBounds;
+    for (unsigned int slice = 0; slice < nSlices; slice++)
+        centreBounds.Extend(sliceCentreBounds[slice]);
+    float scale[3];
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float extent = centreBounds.upper[axis] - centreBounds.lower[axis];
+        scale[axis] = (extent > 0.0f) ? (1u << BVH_MORTON_BITS) / extent : 0.0f;
+    }
+    codes.resize(count);
+    RunSlices(pool, [&](unsigned int slice) {
+        unsigned int sliceEnd = SliceStart(0, count, slice + 1, nSlices);
+        for (unsigned int prim = SliceStart(0, count, slice, nSlices); prim < sliceEnd; prim++) {
+            const Cartesian3& centre = buildPrimitives[primitives[prim]].centre;
+            uint32_t code = 0;
+            for (unsigned int axis = 0; axis < 3; axis++) {
+                uint32_t cell = std::min((1u << BVH_MORTON_BITS) - 1, (uint32_t)
+                    ((centre[axis] - centreBounds.lower[axis]) * scale[axis]));
+                code |= SpreadBits(cell) << (2 - axis);
+            }
+            codes[prim] = code;
+        }
+    });
+
+    // least significant digit first radix sort of the codes and primitives.
+    // Each part counts its digits, which gives every part where its triangles
+    // with each digit go. The passes are stable, so the order does not depend
+    // on the number of threads
+    std::vector<uint32_t> sortedCodes(count);
+    std::vector<unsigned int> sortedPrimitives(count);
+    std::vector<unsigned int> offsets(nSlices * BVH_RADIX_BUCKETS);
+    for (unsigned int shift = 0; shift < 3 * BVH_MORTON_BITS; shift += BVH_RADIX_BITS) {
+        RunSlices(pool, [&](unsigned int slice) {
+            unsigned int* sliceOffsets = &offsets[slice * BVH_RADIX_BUCKETS];
+            std::fill(sliceOffsets, sliceOffsets + BVH_RADIX_BUCKETS, 0u);
+            unsigned int sliceEnd = SliceStart(0, count, slice + 1, nSlices);
+            for (unsigned int prim = SliceStart(0, count, slice, nSlices); prim < sliceEnd; prim++)
+                sliceOffsets[(codes[prim] >> shift) & (BVH_RADIX_BUCKETS - 1)]++;
+        });
+        unsigned int start = 0;
+        for (unsigned int digit = 0; digit < BVH_RADIX_BUCKETS; digit++)
+            for (unsigned int slice = 0; slice < nSlices; slice++) {
+                unsigned int digitCount = offsets[slice * BVH_RADIX_BUCKETS + digit];
+                offsets[slice * BVH_RADIX_BUCKETS + digit] = start;
+                start += digitCount;
+            }
+        RunSlices(pool, [&](unsigned int slice) {
+            unsigned int* sliceOffsets = &offsets[slice * BVH_RADIX_BUCKETS];
+            unsigned int sliceEnd = SliceStart(0, count, slice + 1, nSlices);
+            for (unsigned int prim = SliceStart(0, count, slice, nSlices); prim < sliceEnd; prim++) {
+                unsigned int to = sliceOffsets[(codes[prim] >> shift) & (BVH_RADIX_BUCKETS - 1)]++;
+                sortedCodes[to] = codes[prim];
+                sortedPrimitives[to] = primitives[prim];
+            }
+        });
+        codes.swap(sortedCodes);
+        primitives.swap(sortedPrimitives);
+    }
+}
+
+// where the sorted codes of [begin, end) first differ in their highest bit
+unsigned int BVH::MortonSplit(const std::vector<uint32_t>& codes,
+    unsigned int begin, unsigned int end) {
+    uint32_t first = codes[begin], last = codes[end - 1];
+    // the centres share a grid cell, just halve the range
+    if (first == last)
+        return begin + (end - begin) / 2;
+    // the codes agree on every bit above the highest one the ends differ in, so
+    // all of those with it clear come first
+    uint32_t bit = 1u << (31 - __builtin_clz(first ^ last));
+    return std::partition_point(codes.begin() + begin, codes.begin() + end,
+        [bit](uint32_t code) { return (code & bit) == 0; }) - codes.begin();
+}
+
+// split the sorted primitives in [begin, end) into the subtree, the bounds of
+// interior nodes come from their children so the triangles are only read once
+unsigned int BVH::BuildLinearRecursive(const std::vector<BuildPrimitive>& buildPrimitives,
+    const std::vector<uint32_t>& codes, std::vector<BVHNode>& subtree,
+    unsigned int begin, unsigned int end, unsigned int depth) {
+    unsigned int nodeIndex = subtree.size();
+    subtree.push_back(BVHNode());
+
+    unsigned int count = end - begin;
+    if ((count <= BVH_LEAF_SIZE) || (depth >= BVH_MAX_DEPTH - 1)) {
+        AABB bounds;
+        for (unsigned int prim = begin; prim < end; prim++)
+            bounds.Extend(buildPrimitives[primitives[prim]].bounds);
+        subtree[nodeIndex] = BVHNode{bounds, begin, count};
+        return nodeIndex;
+    }
+
+    unsigned int middle = MortonSplit(codes, begin, end);
+    BuildLinearRecursive(buildPrimitives, codes, subtree, begin, middle, depth + 1);
+    unsigned int second = BuildLinearRecursive(buildPrimitives, codes, subtree,
+        middle, end, depth + 1);
+    subtree[nodeIndex].bounds = subtree[nodeIndex + 1].bounds;
+    subtree[nodeIndex].bounds.Extend(subtree[second].bounds);
+    subtree[nodeIndex].first = second;
+    subtree[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+// split the sorted primitives in [begin, end) until the ranges are small
+// enough to be subtrees
+unsigned int BVH::BuildLinearTop(const std::vector<uint32_t>& codes,
+    std::vector<TopNode>& top, std::vector<unsigned int>& subtreeRoots,
+    unsigned int begin, unsigned int end, unsigned int depth) {
+    unsigned int topIndex = top.size();
+    top.push_back(TopNode{begin, end, depth, {0, 0}, false});
+    if ((end - begin <= BVH_PARALLEL_THRESHOLD) || (depth >= BVH_MAX_DEPTH - 1)) {
+        top[topIndex].isSubtree = true;
+        top[topIndex].children[0] = subtreeRoots.size();
+        subtreeRoots.push_back(topIndex);
+        return topIndex;
+    }
+
+    unsigned int middle = MortonSplit(codes, begin, end);
+    unsigned int first = BuildLinearTop(codes, top, subtreeRoots, begin, middle, depth + 1);
+    unsigned int second = BuildLinearTop(codes, top, subtreeRoots, middle, end, depth + 1);
+    top[topIndex].children[0] = first;
+    top[topIndex].children[1] = second;
+    return topIndex;
+}
+
+// reorganise every treelet of a subtree whose root is at the given depth. A
+// treelet is a node and its descendants opened up, the largest first, until it
+// has BVH_TREELET_SIZE leaves. The cheapest binary tree over every subset of
+// those leaves is found smallest subset first, and replaces the treelet's
+// interior nodes if it is cheaper and no deeper than the hierarchy allows.
+// Treelets over fewer than BVH_TREELET_MIN_PRIMITIVES triangles are skipped
+void BVH::OptimizeTreelets(std::vector<BVHNode>& subtree, unsigned int depth) {
+    unsigned int n = subtree.size();
+
+    // make the children explicit while the nodes are moved around
+    std::vector<unsigned int> left(n, 0), right(n, 0), depths(n), heights(n, 0);
+    std::vector<unsigned int> counts(n);
+    std::vector<float> costs(n);
+    depths[0] = depth;
+    for (unsigned int node = 0; node < n; node++)
+        if (!subtree[node].IsLeaf()) {
+            left[node] = node + 1;
+            right[node] = subtree[node].first;
+            depths[left[node]] = depths[right[node]] = depths[node] + 1;
+        }
+
+    // children come after their parent, so going backwards every treelet is
+    // visited after those below it. The depths only change below a treelet
+    // that was reorganised, which is never visited again
+    constexpr unsigned int SUBSETS = 1u << BVH_TREELET_SIZE;
+    for (unsigned int root = n; root-- > 0; ) {
+        if (subtree[root].IsLeaf()) {
+            costs[root] = subtree[root].bounds.SurfaceArea() * subtree[root].count;
+            counts[root] = subtree[root].count;
+            continue;
+        }
+
+        // a root's children are never moved by the treelets below them
+        counts[root] = counts[left[root]] + counts[right[root]];
+        if (counts[root] < BVH_TREELET_MIN_PRIMITIVES) {
+            costs[root] = BVH_TRAVERSAL_COST * subtree[root].bounds.SurfaceArea() +
+                costs[left[root]] + costs[right[root]];
+            heights[root] = 1 + std::max(heights[left[root]], heights[right[root]]);
+            continue;
+        }
+
+        // open up the treelet
+        unsigned int leaves[BVH_TREELET_SIZE], inner[BVH_TREELET_SIZE - 1];
+        unsigned int nLeaves = 2, nInner = 1;
+        leaves[0] = left[root];
+        leaves[1] = right[root];
+        inner[0] = root;
+        while (nLeaves < BVH_TREELET_SIZE) {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (unsigned int leaf = 0; leaf < nLeaves; leaf++)
+                if (!subtree[leaves[leaf]].IsLeaf() &&
+                    (subtree[leaves[leaf]].bounds.SurfaceArea() > largestArea)) {
+                    largest = leaf;
+                    largestArea = subtree[leaves[leaf]].bounds.SurfaceArea();
+                }
+            if (largest < 0)
+                break;
+            unsigned int opened = leaves[largest];
+            inner[nInner++] = opened;
+            leaves[largest] = left[opened];
+            leaves[nLeaves++] = right[opened];
+        }
+
+        // every proper subset of a subset is smaller as a number, so going up
+        // through them finds the parts before the whole
+        AABB subsetBounds[SUBSETS];
+        float subsetCosts[SUBSETS];
+        unsigned int subsetSplits[SUBSETS], subsetHeights[SUBSETS];
+        unsigned int all = (1u << nLeaves) - 1;
+        for (unsigned int subset = 1; subset <= all; subset++) {
+            unsigned int lowest = subset & (~subset + 1);
+            if (subset == lowest) {
+                unsigned int leaf = leaves[__builtin_ctz(subset)];
+                subsetBounds[subset] = subtree[leaf].bounds;
+                subsetCosts[subset] = costs[leaf];
+                subsetHeights[subset] = heights[leaf];
+                continue;
+            }
+            subsetBounds[subset] = subsetBounds[lowest];
+            subsetBounds[subset].Extend(subsetBounds[subset ^ lowest]);
+            // the lowest leaf always goes left, so each split is tried once
+            unsigned int rest = subset ^ lowest;
+            float best = std::numeric_limits<float>::infinity();
+            for (unsigned int part = (rest - 1) & rest; ; part = (part - 1) & rest) {
+                unsigned int first = lowest | part;
+                float cost = subsetCosts[first] + subsetCosts[subset ^ first];
+                if (cost < best) {
+                    best = cost;
+                    subsetSplits[subset] = first;
+                }
+                if (part == 0)
+                    break;
+            }
+            subsetCosts[subset] = BVH_TRAVERSAL_COST * subsetBounds[subset].SurfaceArea() + best;
+            subsetHeights[subset] = 1 + std::max(subsetHeights[subsetSplits[subset]],
+                subsetHeights[subset ^ subsetSplits[subset]]);
+        }
+
+        float currentCost = BVH_TRAVERSAL_COST * subtree[root].bounds.SurfaceArea() +
+            costs[left[root]] + costs[right[root]];
+        if ((subsetCosts[all] < currentCost) &&
+            (depths[root] + subsetHeights[all] <= BVH_MAX_DEPTH - 1)) {
+            // hand the treelet's interior nodes out again, the root stays put
+            unsigned int stack[BVH_TREELET_SIZE][2], stackSize = 0, nextInner = 1;
+            stack[stackSize][0] = all;
+            stack[stackSize++][1] = root;
+            while (stackSize > 0) {
+                stackSize--;
+                unsigned int subset = stack[stackSize][0], node = stack[stackSize][1];
+                subtree[node].bounds = subsetBounds[subset];
+                costs[node] = subsetCosts[subset];
+                heights[node] = subsetHeights[subset];
+                unsigned int parts[2] = { subsetSplits[subset], subset ^ subsetSplits[subset] };
+                unsigned int children[2];
+                for (unsigned int side = 0; side < 2; side++) {
+                    if ((parts[side] & (parts[side] - 1)) == 0)
+                        children[side] = leaves[__builtin_ctz(parts[side])];
+                    else {
+                        children[side] = inner[nextInner++];
+                        stack[stackSize][0] = parts[side];
+                        stack[stackSize++][1] = children[side];
+                    }
+                }
+                left[node] = children[0];
+                right[node] = children[1];
+            }
+        }
+        else {
+            costs[root] = currentCost;
+            heights[root] = 1 + std::max(heights[left[root]], heights[right[root]]);
+        }
+    }
+
+    // lay the nodes out depth first again, the first child after its parent
+    std::vector<BVHNode> ordered;
+    ordered.reserve(n);
+    std::vector<std::pair<unsigned int, unsigned int>> stack;
+    const unsigned int noParent = std::numeric_limits<unsigned int>::max();
+    stack.push_back({0, noParent});
+    while (!stack.empty()) {
+        unsigned int node = stack.back().first, parent = stack.back().second;
+        stack.pop_back();
+        if (parent != noParent)
+            ordered[parent].first = ordered.size();
+        if (!subtree[node].IsLeaf()) {
+            stack.push_back({right[node], ordered.size()});
+            stack.push_back({left[node], noParent});
+        }
+        ordered.push_back(subtree[node]);
+    }
+    subtree.swap(ordered);
+}
+
+// build the hierarchy with spatial splits. A split can put a triangle on both
+// of its sides, so the ranges of the other builds give way to a set of
+// references for each node, and each subtree gathers its own primitives
+void BVH::BuildSpatial(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, ThreadPool* pool) {
+    nodes.clear();
+    primitives.clear();
+    if (faces.empty())
+        return;
+
+    // every triangle starts as a single reference bounded by the whole of it
+    ReferenceSet root;
+    root.references.resize(faces.size());
+    root.budget = (unsigned int) (BVH_SPATIAL_BUDGET * faces.size());
+    RunSlices(pool, [&](unsigned int slice) {
+        unsigned int last = SliceStart(0, faces.size(), slice + 1, SliceCount(pool));
+        for (unsigned int tri = SliceStart(0, faces.size(), slice, SliceCount(pool));
+            tri < last; tri++)
+            root.references[tri] = Reference{TriangleBounds(vertices, faces[tri]), tri};
+    });
+    AABB rootBounds;
+    for (const Reference& reference : root.references)
+        rootBounds.Extend(reference.bounds);
+    float rootArea = rootBounds.SurfaceArea();
+
+    // split the top levels on this thread, the clipping is not worth sharing
+    // out there, or leave the whole hierarchy as a subtree without a pool
+    std::vector<TopNode> top;
+    std::vector<ReferenceSet> subtreeSets;
+    std::vector<unsigned int> subtreeRoots;
+    if (pool != nullptr)
+        BuildSpatialTop(vertices, faces, root, rootArea, top, subtreeSets, subtreeRoots, 0);
+    else {
+        top.push_back(TopNode{0, (unsigned int) faces.size(), 0, {0, 0}, true});
+        subtreeRoots.push_back(0);
+        subtreeSets.push_back(std::move(root));
+    }
+
+    // then build the subtrees, the largest first
+    std::vector<std::vector<BVHNode>> subtrees(subtreeRoots.size());
+    std::vector<std::vector<unsigned int>> subtreePrimitives(subtreeRoots.size());
+    std::vector<unsigned int> order(subtreeRoots.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        return top[subtreeRoots[a]].end > top[subtreeRoots[b]].end;
+    });
+    std::atomic<unsigned int> nextSubtree(0);
+    RunSlices(pool, [&](unsigned int) {
+        for (unsigned int task = nextSubtree++; task < order.size(); task = nextSubtree++) {
+            unsigned int subtree = order[task];
+            BuildSpatialRecursive(vertices, faces, subtreeSets[subtree], rootArea,
+                subtrees[subtree], subtreePrimitives[subtree],
+                top[subtreeRoots[subtree]].depth);
+        }
+    });
+
+    // and stitch them under the top levels
+    Flatten(pool, top, subtrees, &subtreePrimitives);
+}
+
+// split a triangle's reference at a plane. Each side is bounded by the part of
+// the triangle on it, the vertices on that side and the points where the edges
+// cross the plane, kept within the reference's bounds. A side the triangle
+// does not reach is left empty
+void BVH::SplitReference(const std::vector<Cartesian3>& vertices,
+    const Triangle& triangle, const Reference& reference, unsigned int axis,
+    float position, Reference& left, Reference& right) {
+    left = Reference{AABB(), reference.prim};
+    right = Reference{AABB(), reference.prim};
+    for (unsigned int vertex = 0; vertex < 3; vertex++) {
+        const Cartesian3& from = vertices[triangle.vertices[vertex]];
+        const Cartesian3& to = vertices[triangle.vertices[(vertex + 1) % 3]];
+        if (from[axis] <= position)
+            left.bounds.Extend(from);
+        if (from[axis] >= position)
+            right.bounds.Extend(from);
+        if (((from[axis] < position) && (to[axis] > position)) ||
+            ((from[axis] > position) && (to[axis] < position))) {
+            Cartesian3 crossing = from + (to - from) *
+                ((position - from[axis]) / (to[axis] - from[axis]));
+            crossing[axis] = position;
+            left.bounds.Extend(crossing);
+            right.bounds.Extend(crossing);
+        }
+    }
+
+    AABB leftClip = reference.bounds, rightClip = reference.bounds;
+    leftClip.upper[axis] = std::min(leftClip.upper[axis], position);
+    rightClip.lower[axis] = std::max(rightClip.lower[axis], position);
+    ClipBox(left.bounds, leftClip);
+    ClipBox(right.bounds, rightClip);
+}
+
+// bin the references by where their parts lie. Each is cut at the planes
+// between the bins it spans, every bin is extended by the part in it, and the
+// reference is counted as entering its first bin and exiting its last
+void BVH::BinSpatial(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, const std::vector<Reference>& references,
+    const AABB& bounds, SpatialBins& bins) {
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float extent = bounds.upper[axis] - bounds.lower[axis];
+        if (extent <= 0.0f)
+            continue;
+        float binScale = BVH_BINS / extent, binWidth = extent / BVH_BINS;
+        for (const Reference& reference : references) {
+            unsigned int firstBin = BinIndex(reference.bounds.lower[axis],
+                bounds.lower[axis], binScale);
+            unsigned int lastBin = BinIndex(reference.bounds.upper[axis],
+                bounds.lower[axis], binScale);
+            Reference rest = reference;
+            for (unsigned int bin = firstBin; bin < lastBin; bin++) {
+                Reference part, remainder;
+                SplitReference(vertices, faces[reference.prim], rest, axis,
+                    bounds.lower[axis] + (bin + 1) * binWidth, part, remainder);
+                bins.bounds[axis][bin].Extend(part.bounds);
+                rest = remainder;
+            }
+            bins.bounds[axis][lastBin].Extend(rest.bounds);
+            bins.entries[axis][firstBin]++;
+            bins.exits[axis][lastBin]++;
+        }
+    }
+}
+
+// sweep the spatial bins for the plane with the lowest cost, the same as
+// FindSplit but a reference counts on every side it has a part on
+BVH::Split BVH::FindSpatialSplit(const SpatialBins& bins, const AABB& bounds) {
+    Split best{std::numeric_limits<float>::infinity(), 0, 0};
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        if (bounds.upper[axis] - bounds.lower[axis] <= 0.0f)
+            continue;
+
+        float rightAreas[BVH_BINS];
+        unsigned int rightCounts[BVH_BINS];
+        AABB rightBounds;
+        unsigned int rightCount = 0;
+        for (unsigned int bin = BVH_BINS - 1; bin > 0; bin--) {
+            rightBounds.Extend(bins.bounds[axis][bin]);
+            rightCount += bins.exits[axis][bin];
+            rightAreas[bin] = rightBounds.SurfaceArea();
+            rightCounts[bin] = rightCount;
+        }
+
+        AABB leftBounds;
+        unsigned int leftCount = 0;
+        for (unsigned int bin = 1; bin < BVH_BINS; bin++) {
+            leftBounds.Extend(bins.bounds[axis][bin - 1]);
+            leftCount += bins.entries[axis][bin - 1];
+            if ((leftCount == 0) || (rightCounts[bin] == 0))
+                continue;
+            float cost = leftCount * leftBounds.SurfaceArea() +
+                rightCounts[bin] * rightAreas[bin];
+            if (cost < best.cost)
+                best = Split{cost, axis, bin};
+        }
+    }
+    return best;
+}
+
+// split a node's references with whichever of the object and spatial splits
+// is cheaper. The budget left once the split has added its references is
+// shared between the children by how many references each has
+bool BVH::SplitReferences(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, const ReferenceSet& set,
+    const AABB& bounds, float rootArea, ReferenceSet& left, ReferenceSet& right) {
+    const std::vector<Reference>& references = set.references;
+    unsigned int count = references.size();
+
+    // the object split, binning the references by the centres of their bounds
+    AABB centreBounds;
+    for (const Reference& reference : references)
+        centreBounds.Extend(reference.bounds.Centre());
+    Bins bins;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float extent = centreBounds.upper[axis] - centreBounds.lower[axis];
+        if (extent <= 0.0f)
+            continue;
+        float binScale = BVH_BINS / extent;
+        for (const Reference& reference : references) {
+            unsigned int bin = BinIndex(reference.bounds.Centre()[axis],
+                centreBounds.lower[axis], binScale);
+            bins.bounds[axis][bin].Extend(reference.bounds);
+            bins.counts[axis][bin]++;
+        }
+    }
+    Split objectSplit = FindSplit(bins, centreBounds);
+
+    // the spatial split, only where the object split's children overlap, or
+    // there is no object split, and references can still be added
+    Split spatialSplit{std::numeric_limits<float>::infinity(), 0, 0};
+    SpatialBins spatialBins;
+    bool trySpatial = set.budget > 0;
+    if (trySpatial && (objectSplit.cost < std::numeric_limits<float>::infinity())) {
+        AABB leftBounds, rightBounds;
+        for (unsigned int bin = 0; bin < BVH_BINS; bin++)
+            (bin < objectSplit.bin ? leftBounds : rightBounds).Extend(
+                bins.bounds[objectSplit.axis][bin]);
+        ClipBox(leftBounds, rightBounds);
+        trySpatial = leftBounds.SurfaceArea() > BVH_SPATIAL_OVERLAP * rootArea;
+    }
+    if (trySpatial) {
+        BinSpatial(vertices, faces, references, bounds, spatialBins);
+        spatialSplit = FindSpatialSplit(spatialBins, bounds);
+    }
+
+    Split split = (spatialSplit.cost < objectSplit.cost) ? spatialSplit : objectSplit;
+    if (KeepLeaf(split, bounds, count))
+        return false;
+
+    left.references.clear();
+    right.references.clear();
+    unsigned int added = 0;
+    if (spatialSplit.cost < objectSplit.cost) {
+        unsigned int axis = spatialSplit.axis;
+        float position = bounds.lower[axis] +
+            spatialSplit.bin * ((bounds.upper[axis] - bounds.lower[axis]) / BVH_BINS);
+        AABB leftBounds, rightBounds;
+        unsigned int leftCount = 0, rightCount = 0;
+        for (unsigned int bin = 0; bin < BVH_BINS; bin++)
+            if (bin < spatialSplit.bin) {
+                leftBounds.Extend(spatialBins.bounds[axis][bin]);
+                leftCount += spatialBins.entries[axis][bin];
+            }
+            else {
+                rightBounds.Extend(spatialBins.bounds[axis][bin]);
+                rightCount += spatialBins.exits[axis][bin];
+            }
+
+        // a reference across the plane can be cheaper kept whole on one side,
+        // and has to be once the budget is spent
+        for (const Reference& reference : references) {
+            if (reference.bounds.upper[axis] <= position) {
+                left.references.push_back(reference);
+                continue;
+            }
+            if (reference.bounds.lower[axis] >= position) {
+                right.references.push_back(reference);
+                continue;
+            }
+            AABB leftWhole = leftBounds, rightWhole = rightBounds;
+            leftWhole.Extend(reference.bounds);
+            rightWhole.Extend(reference.bounds);
+            float splitCost = (added < set.budget) ? leftBounds.SurfaceArea() * leftCount +
+                rightBounds.SurfaceArea() * rightCount : std::numeric_limits<float>::infinity();
+            float leftCost = leftWhole.SurfaceArea() * leftCount +
+                rightBounds.SurfaceArea() * (rightCount - 1);
+            float rightCost = leftBounds.SurfaceArea() * (leftCount - 1) +
+                rightWhole.SurfaceArea() * rightCount;
+            if ((splitCost <= leftCost) && (splitCost <= rightCost)) {
+                Reference leftPart, rightPart;
+                SplitReference(vertices, faces[reference.prim], reference, axis, position,
+                    leftPart, rightPart);
+                if (!IsEmpty(leftPart.bounds))
+                    left.references.push_back(leftPart);
+                if (!IsEmpty(rightPart.bounds))
+                    right.references.push_back(rightPart);
+                added += !IsEmpty(leftPart.bounds) && !IsEmpty(rightPart.bounds);
+            }
+            else if (leftCost <= rightCost) {
+                left.references.push_back(reference);
+                leftBounds = leftWhole;
+                rightCount--;
+            }
+            else {
+                right.references.push_back(reference);
+                rightBounds = rightWhole;
+                leftCount--;
+            }
+        }
+        // the bins only estimate which side each reference falls on, should
+        // one side end up empty the object split is used after all
+        if (left.references.empty() || right.references.empty()) {
+            left.references.clear();
+            right.references.clear();
+            added = 0;
+            split = objectSplit;
+        }
+    }
+
+    if (left.references.empty()) {
+        if (split.cost < std::numeric_limits<float>::infinity()) {
+            float lowerBound = centreBounds.lower[split.axis];
+            float binScale = BVH_BINS / (centreBounds.upper[split.axis] - lowerBound);
+            for (const Reference& reference : references)
+                (BinIndex(reference.bounds.Centre()[split.axis], lowerBound, binScale) <
+                    split.bin ? left : right).references.push_back(reference);
+        }
+        else {
+            // every centre coincides, just halve the references
+            left.references.assign(references.begin(), references.begin() + count / 2);
+            right.references.assign(references.begin() + count / 2, references.end());
+        }
+    }
+
+    unsigned int remaining = set.budget - added;
+    left.budget = (unsigned int) ((uint64_t) remaining * left.references.size() /
+        (left.references.size() + right.references.size()));
+    right.budget = remaining - left.budget;
+    return true;
+}
+
+// recursively split the references into the subtree, the leaves index the
+// subtree's own primitives
+unsigned int BVH::BuildSpatialRecursive(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, ReferenceSet& set, float rootArea,
+    std::vector<BVHNode>& subtree, std::vector<unsigned int>& subtreePrimitives,
+    unsigned int depth) {
+    unsigned int nodeIndex = subtree.size();
+    subtree.push_back(BVHNode());
+
+    AABB bounds;
+    for (const Reference& reference : set.references)
+        bounds.Extend(reference.bounds);
+    subtree[nodeIndex].bounds = bounds;
+
+    unsigned int count = set.references.size();
+    ReferenceSet left, right;
+    if ((count <= BVH_LEAF_SIZE) || (depth >= BVH_MAX_DEPTH - 1) ||
+        !SplitReferences(vertices, faces, set, bounds, rootArea, left, right)) {
+        subtree[nodeIndex].first = subtreePrimitives.size();
+        subtree[nodeIndex].count = count;
+        for (const Reference& reference : set.references)
+            subtreePrimitives.push_back(reference.prim);
+        return nodeIndex;
+    }
+    // the children have their own copies, so this node's go before going down
+    std::vector<Reference>().swap(set.references);
+
+    BuildSpatialRecursive(vertices, faces, left, rootArea, subtree, subtreePrimitives,
+        depth + 1);
+    unsigned int second = BuildSpatialRecursive(vertices, faces, right, rootArea, subtree,
+        subtreePrimitives, depth + 1);
+    subtree[nodeIndex].first = second;
+    subtree[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+// split the references until there are few enough to be a subtree. The top
+// node's end holds the number of references, the subtrees are ordered by it
+unsigned int BVH::BuildSpatialTop(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, ReferenceSet& set, float rootArea,
+    std::vector<TopNode>& top, std::vector<ReferenceSet>& subtreeSets,
+    std::vector<unsigned int>& subtreeRoots, unsigned int depth) {
+    unsigned int topIndex = top.size();
+    unsigned int count = set.references.size();
+    top.push_back(TopNode{0, count, depth, {0, 0}, false});
+
+    AABB bounds;
+    for (const Reference& reference : set.references)
+        bounds.Extend(reference.bounds);
+    ReferenceSet left, right;
+    if ((count <= BVH_PARALLEL_THRESHOLD) || (depth >= BVH_MAX_DEPTH - 1) ||
+        !SplitReferences(vertices, faces, set, bounds, rootArea, left, right)) {
+        top[topIndex].isSubtree = true;
+        top[topIndex].children[0] = subtreeRoots.size();
+        subtreeRoots.push_back(topIndex);
+        subtreeSets.push_back(std::move(set));
+        return topIndex;
+    }
+    std::vector<Reference>().swap(set.references);
+
+    unsigned int first = BuildSpatialTop(vertices, faces, left, rootArea, top,
+        subtreeSets, subtreeRoots, depth + 1);
+    unsigned int second = BuildSpatialTop(vertices, faces, right, rootArea, top,
+        subtreeSets, subtreeRoots, depth + 1);
+    top[topIndex].children[0] = first;
+    top[topIndex].children[1] = second;
+    return topIndex;
+}
+
+// grow or shrink the boxes to primitives that moved, keeping the hierarchy's
+// shape. Children come after their parent, so going backwards every node is
+// bounded after its children
+void BVH::Refit(const std::vector<AABB>& bounds) {
+    for (unsigned int node = nodes.size(); node-- > 0; ) {
+        BVHNode& refitted = nodes[node];
+        refitted.bounds = AABB();
+        if (refitted.IsLeaf())
+            for (unsigned int prim = refitted.first; prim < refitted.first + refitted.count; prim++)
+                refitted.bounds.Extend(bounds[primitives[prim]]);
+        else {
+            refitted.bounds.Extend(nodes[node + 1].bounds);
+            refitted.bounds.Extend(nodes[refitted.first].bounds);
+        }
+    }
+}
+
+// the expected number of nodes visited and triangles tested by a ray through
+// the root, weighting each node by the chance of hitting its box
+float BVH::SAHCost() const {
+    if (nodes.empty() || (nodes[0].bounds.SurfaceArea() <= 0.0f))
+        return 0.0f;
+    double cost = 0.0;
+    for (const BVHNode& node : nodes)
+        cost += node.bounds.SurfaceArea() *
+            (node.IsLeaf() ? node.count : BVH_TRAVERSAL_COST);
+    return cost / nodes[0].bounds.SurfaceArea();
+}
+
+// bounds of a single triangle
+AABB BVH::TriangleBounds(const std::vector<Cartesian3>& vertices,
+    const Triangle& triangle) {
+    AABB bounds;
+    for (unsigned int vertex = 0; vertex < 3; vertex++)
+        bounds.Extend(vertices[triangle.vertices[vertex]]);
+    return bounds;
+}
@@ -0,0 +1,275 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Cartesian3.h"
+#include "Utils.h"
+
+// maximum depth of the hierarchy, also the size of the traversal stack
+constexpr unsigned int BVH_MAX_DEPTH = 64;
+// number of bins used when evaluating the surface area heuristic
+constexpr unsigned int BVH_BINS = 16;
+// leaves with this many triangles or fewer are never split
+constexpr unsigned int BVH_LEAF_SIZE = 2;
+// ranges with more triangles than this are split with every thread, smaller
+// ones are built as a subtree by a single thread
+constexpr unsigned int BVH_PARALLEL_THRESHOLD = 1 << 14;
+// leaves of the treelets the linear build reorganises, every subset of them is
+// searched so the cost grows by three times with each one
+constexpr unsigned int BVH_TREELET_SIZE = 7;
+// treelets over fewer triangles than this are left as they are. Most treelets
+// are small, so this skips three quarters of the work and keeps half to three
+// quarters of the gain
+constexpr unsigned int BVH_TREELET_MIN_PRIMITIVES = 64;
+// the extra references to triangles a spatial split build may add, as a
+// fraction of the triangles. Each costs an index and a triangle table entry
+constexpr float BVH_SPATIAL_BUDGET = 0.5f;
+
+// how the hierarchy is built
+enum BVHBuildMode {
+    // binned surface area heuristic, the slowest build and the fastest to trace
+    BVH_BUILD_SAH,
+    // triangles sorted along a Morton curve and split where their codes
+    // differ, for rebuilding in a fraction of the time
+    BVH_BUILD_LINEAR,
+    // the linear build with each small treelet reorganised for the lowest cost
+    BVH_BUILD_LINEAR_TREELETS,
+    // the surface area heuristic, also splitting triangles across planes where
+    // their boxes overlap, the slowest build and the fewest nodes visited on
+    // long thin triangles. A triangle can then be in several leaves
+    BVH_BUILD_SPATIAL
+};
+
+class ThreadPool;
+
+// an axis aligned bounding box
+struct AABB {
+    // an empty box, extending it with anything gives that thing's bounds
+    AABB();
+    AABB(const Cartesian3& lower, const Cartesian3& upper)
+        : lower(lower), upper(upper) {}
+
+    // grow the box to contain a point or another box
+    void Extend(const Cartesian3& point);
+    void Extend(const AABB& other);
+
+    // box properties
+    Cartesian3 Centre() const;
+    float SurfaceArea() const;
+    unsigned int LargestAxis() const;
+
+    // slab test against a ray with precomputed inverse direction, returns the
+    // entry distance in tEntry if the ray hits the box within [tMin, tMax]
+    bool Intersect(const Ray& ray, const Cartesian3& invDir,
+        float tMin, float tMax, float& tEntry) const;
+
+    Cartesian3 lower, upper;
+};
+
+// a node of the flattened hierarchy (32 bytes). Nodes are laid out depth first
+// so the first child of an interior node always directly follows it
+struct BVHNode {
+    AABB bounds;
+    // leaves: index of the first primitive, interior nodes: second child index
+    unsigned int first;
+    // number of primitives in a leaf, 0 for interior nodes
+    unsigned int count;
+
+    bool IsLeaf() const { return count != 0; }
+};
+
+// a bounding volume hierarchy over the triangles of an object, built with the
+// binned surface area heuristic, with spatial splits or along a Morton curve.
+// With a thread pool the top levels are split by every thread at once and the
+// subtrees below them are built in parallel
+class BVH {
+    public:
+        BVH() {}
+        ~BVH() {}
+
+        // build the hierarchy from scratch, on the pool's threads if there is one
+        void Build(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, ThreadPool* pool = nullptr,
+            BVHBuildMode mode = BVH_BUILD_SAH);
+        // the same over boxes, each one a primitive. Boxes cannot be split, so
+        // the spatial split mode builds with the surface area heuristic
+        void Build(const std::vector<AABB>& bounds, ThreadPool* pool = nullptr,
+            BVHBuildMode mode = BVH_BUILD_SAH);
+
+        // bound the nodes again after the primitives' boxes changed, the
+        // hierarchy keeps its shape
+        void Refit(const std::vector<AABB>& bounds);
+
+        bool Empty() const { return nodes.empty(); }
+
+        // the surface area heuristic's estimate of the cost of a ray through the
+        // root, in triangle tests, lower is a better hierarchy
+        float SAHCost() const;
+
+        // bounds of a single triangle
+        static AABB TriangleBounds(const std::vector<Cartesian3>& vertices,
+            const Triangle& triangle);
+
+    private:
+        // per triangle data only needed during the build
+        struct BuildPrimitive {
+            AABB bounds;
+            Cartesian3 centre;
+        };
+
+        // the triangles of a range sorted into bins along every axis
+        struct Bins {
+            Bins();
+            // add the bins of another part of the same range
+            void Merge(const Bins& other);
+
+            AABB bounds[3][BVH_BINS];
+            unsigned int counts[3][BVH_BINS];
+        };
+
+        // the cheapest plane to split a range at, cost is infinite if there is none
+        struct Split {
+            float cost;
+            unsigned int axis, bin;
+        };
+
+        // a node in the top levels of a parallel build, either split further or
+        // the root of a subtree built by a single thread
+        struct TopNode {
+            unsigned int begin, end, depth;
+            // the two children, or the subtree in children[0]
+            unsigned int children[2];
+            bool isSubtree;
+        };
+
+        // a triangle in a spatial split build, bounded by the part of it on
+        // this side of the planes it was split across
+        struct Reference {
+            AABB bounds;
+            unsigned int prim;
+        };
+
+        // the references under a node of a spatial split build and how many
+        // more the splits below it may add
+        struct ReferenceSet {
+            std::vector<Reference> references;
+            unsigned int budget;
+        };
+
+        // the parts of references in each bin of a range along every axis, and
+        // how many references start and end in each
+        struct SpatialBins {
+            SpatialBins();
+
+            AABB bounds[3][BVH_BINS];
+            unsigned int entries[3][BVH_BINS], exits[3][BVH_BINS];
+        };
+
+        // build the hierarchy over the primitives' bounds and centres
+        void Build(const std::vector<BuildPrimitive>& buildPrimitives, ThreadPool* pool,
+            BVHBuildMode mode);
+
+        // bin the triangles in [begin, end) by their centres
+        void BinRange(const std::vector<BuildPrimitive>& buildPrimitives,
+            unsigned int begin, unsigned int end, const AABB& centreBounds,
+            Bins& bins) const;
+
+        // sweep the bins for the plane with the lowest cost
+        static Split FindSplit(const Bins& bins, const AABB& centreBounds);
+
+        // whether a range is cheaper, or has to be, kept as a leaf
+        static bool KeepLeaf(const Split& split, const AABB& bounds,
+            unsigned int count);
+
+        // recursively split the primitives in [begin, end) into the subtree,
+        // returns the node index in it
+        unsigned int BuildRecursive(const std::vector<BuildPrimitive>& buildPrimitives,
+            std::vector<BVHNode>& subtree, unsigned int begin, unsigned int end,
+            unsigned int depth);
+
+        // split the primitives in [begin, end) with every thread until the ranges
+        // are small enough to be subtrees, returns the top node index
+        unsigned int BuildTop(ThreadPool& pool,
+            const std::vector<BuildPrimitive>& buildPrimitives,
+            std::vector<unsigned int>& scratch, std::vector<TopNode>& top,
+            std::vector<unsigned int>& subtreeRoots, unsigned int begin,
+            unsigned int end, unsigned int depth);
+
+        // sort the primitives along a Morton curve through the centres, codes
+        // is filled in the sorted order
+        void SortMorton(ThreadPool* pool,
+            const std::vector<BuildPrimitive>& buildPrimitives,
+            std::vector<uint32_t>& codes);
+
+        // where the sorted codes of [begin, end) first differ in their highest bit
+        static unsigned int MortonSplit(const std::vector<uint32_t>& codes,
+            unsigned int begin, unsigned int end);
+
+        // the same as BuildRecursive and BuildTop, splitting at the Morton codes.
+        // The top levels cost next to nothing here, so they are split serially
+        unsigned int BuildLinearRecursive(const std::vector<BuildPrimitive>& buildPrimitives,
+            const std::vector<uint32_t>& codes, std::vector<BVHNode>& subtree,
+            unsigned int begin, unsigned int end, unsigned int depth);
+        static unsigned int BuildLinearTop(const std::vector<uint32_t>& codes,
+            std::vector<TopNode>& top, std::vector<unsigned int>& subtreeRoots,
+            unsigned int begin, unsigned int end, unsigned int depth);
+
+        // reorganise every treelet of a subtree, bottom up, into the shape with
+        // the lowest cost that keeps it within the depth limit
+        static void OptimizeTreelets(std::vector<BVHNode>& subtree, unsigned int depth);
+
+        // build the hierarchy over the triangles with spatial splits, the top
+        // levels are split serially and the subtrees in parallel
+        void BuildSpatial(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, ThreadPool* pool);
+
+        // split a triangle's reference at a plane along an axis
+        static void SplitReference(const std::vector<Cartesian3>& vertices,
+            const Triangle& triangle, const Reference& reference, unsigned int axis,
+            float position, Reference& left, Reference& right);
+
+        // bin the references by where their parts lie, within the node's bounds
+        static void BinSpatial(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, const std::vector<Reference>& references,
+            const AABB& bounds, SpatialBins& bins);
+
+        // sweep the spatial bins for the plane with the lowest cost
+        static Split FindSpatialSplit(const SpatialBins& bins, const AABB& bounds);
+
+        // split a node's references with whichever of the object and spatial
+        // splits is cheaper, returns false if they are kept as a leaf. Spatial
+        // splits are only tried where the object split's children overlap by
+        // a part of the root's area
+        static bool SplitReferences(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, const ReferenceSet& set,
+            const AABB& bounds, float rootArea, ReferenceSet& left, ReferenceSet& right);
+
+        // the same as BuildRecursive and BuildTop over the references, the
+        // subtrees keep their own primitives until they are flattened
+        static unsigned int BuildSpatialRecursive(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, ReferenceSet& set, float rootArea,
+            std::vector<BVHNode>& subtree, std::vector<unsigned int>& subtreePrimitives,
+            unsigned int depth);
+        static unsigned int BuildSpatialTop(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, ReferenceSet& set, float rootArea,
+            std::vector<TopNode>& top, std::vector<ReferenceSet>& subtreeSets,
+            std::vector<unsigned int>& subtreeRoots, unsigned int depth);
+
+        // stitch the subtrees under the top levels into the nodes, depth first.
+        // With subtreePrimitives, each subtree's leaves index its own primitives,
+        // which are gathered into the hierarchy's
+        void Flatten(ThreadPool* pool, const std::vector<TopNode>& top,
+            std::vector<std::vector<BVHNode>>& subtrees,
+            std::vector<std::vector<unsigned int>>* subtreePrimitives = nullptr);
+
+    public:
+        // the flattened nodes, the root is node 0
+        std::vector<BVHNode> nodes;
+        // the indices of the triangles in the object's faces, in leaf order. A
+        // spatial split build lists a triangle once for each leaf it is in
+        std::vector<unsigned int> primitives;
+};
+
+#endif
@@ -0,0 +1,68 @@
+// c++ default libraries
+#include <iostream>
+#include <vector>
+
+#include "BVH.h"
+
+// whether two boxes have exactly the same corners
+static bool SameBox(const AABB& first, const AABB& second) {
+    for (unsigned int axis = 0; axis < 3; axis++)
+        if ((first.lower[axis] != second.lower[axis]) ||
+            (first.upper[axis] != second.upper[axis]))
+            return false;
+    return true;
+}
+
+// extending by an empty box changes nothing, and extending an empty box gives
+// the other box
+static bool CheckEmptyExtend() {
+    const AABB box(Cartesian3(-1.0f, 0.0f, 2.0f), Cartesian3(1.0f, 3.0f, 4.0f));
+    AABB extended = box;
+    extended.Extend(AABB());
+    if (!SameBox(extended, box)) {
+        std::cerr << "extending a box by an empty box changed it" << std::endl;
+        return false;
+    }
+    AABB empty;
+    empty.Extend(box);
+    if (!SameBox(empty, box)) {
+        std::cerr << "extending an empty box did not give the other box" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// two clusters of boxes far apart leave the bins between them empty, the
+// surface area heuristic has to split the root between the clusters
+static bool CheckClusterSplit() {
+    std::vector<AABB> bounds;
+    for (unsigned int box = 0; box < 96; box++)
+        bounds.push_back(AABB(Cartesian3(0.01f * box, 0.0f, 0.0f),
+            Cartesian3(0.01f * box + 0.5f, 1.0f, 1.0f)));
+    for (unsigned int box = 0; box < 32; box++)
+        bounds.push_back(AABB(Cartesian3(100.0f + 0.01f * box, 0.0f, 0.0f),
+            Cartesian3(100.5f + 0.01f * box, 1.0f, 1.0f)));
+
+    BVH bvh;
+    bvh.Build(bounds);
+    // the first child directly follows the root, first holds the second
+    const AABB& firstChild = bvh.nodes[1].bounds;
+    const AABB& secondChild = bvh.nodes[bvh.nodes[0].first].bounds;
+    if ((bvh.nodes[0].IsLeaf()) || (firstChild.upper.x - firstChild.lower.x > 2.0f) ||
+        (secondChild.upper.x - secondChild.lower.x > 2.0f)) {
+        std::cerr << "the root was not split between the clusters, SAH cost "
+            << bvh.SAHCost() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// checks the bounding boxes and the hierarchy built over them
+int main() {
+    bool passed = true;
+    passed &= CheckEmptyExtend();
+    passed &= CheckClusterSplit();
+
+    std::cout << (passed ? "All BVH tests passed" : "BVH tests failed") << std::endl;
+    return passed ? 0 : 1;
+}
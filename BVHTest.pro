@@ -0,0 +1,25 @@
+######################################################################
+# BVH test, checks the bounding boxes and the split of a hierarchy built over
+# them. Run it with make check
+######################################################################
+
+QT -= core gui
+CONFIG -= qt
+CONFIG += console c++17 thread testcase
+TEMPLATE = app
+TARGET = BVHTest
+INCLUDEPATH += .
+
+# Input
+HEADERS += BVH.h \
+           Cartesian3.h \
+           Homogeneous4.h \
+           Matrix4.h \
+           Quaternion.h \
+           RGBAValue.h \
+           ThreadPool.h \
+           Utils.h
+SOURCES += BVH.cpp \
+           BVHTest.cpp \
+           Cartesian3.cpp \
+           ThreadPool.cpp
@@ -17,9 +17,13 @@
 #ifndef CARTESIAN3_H
 #define CARTESIAN3_H
 
+#include <cmath>
 #include <iostream>
 
 // the class - we will rely on POD for sending to GPU
+// the operators are defined inline below so the ray tracer's vector math can
+// stay in registers, and the class stays three packed floats (12 bytes) since
+// vertex arrays, the triangle table and the scene cache depend on the layout
 class Cartesian3
     { // Cartesian3
     public:
@@ -29,7 +33,6 @@ class Cartesian3
     // constructors
     Cartesian3();
     Cartesian3(float X, float Y, float Z);
-    Cartesian3(const Cartesian3 &other);
     
     // equality operator
     bool operator ==(const Cartesian3 &other) const;
@@ -67,8 +70,95 @@ class Cartesian3
 
     }; // Cartesian3
 
+// constructors
+inline Cartesian3::Cartesian3() 
+    : x(0.0), y(0.0), z(0.0) 
+    {}
+
+inline Cartesian3::Cartesian3(float X, float Y, float Z)
+    : x(X), y(Y), z(Z) 
+    {}
+
+// equality operator
+inline bool Cartesian3::operator ==(const Cartesian3 &other) const
+    { // Cartesian3::operator ==()
+    return ((x == other.x) && (y == other.y) && (z == other.z));
+    } // Cartesian3::operator ==()
+
+// addition operator
+inline Cartesian3 Cartesian3::operator +(const Cartesian3 &other) const
+    { // Cartesian3::operator +()
+    return Cartesian3(x + other.x, y + other.y, z + other.z);
+    } // Cartesian3::operator +()
+
+// subtraction operator
+inline Cartesian3 Cartesian3::operator -(const Cartesian3 &other) const
+    { // Cartesian3::operator -()
+    return Cartesian3(x - other.x, y - other.y, z - other.z);
+    } // Cartesian3::operator -()
+
+// multiplication operator
+inline Cartesian3 Cartesian3::operator *(float factor) const
+    { // Cartesian3::operator *()
+    return Cartesian3(x * factor, y * factor, z * factor);
+    } // Cartesian3::operator *()
+
+// division operator
+inline Cartesian3 Cartesian3::operator /(float factor) const
+    { // Cartesian3::operator /()
+    return Cartesian3(x / factor, y / factor, z / factor);
+    } // Cartesian3::operator /()
+
+// unary minus operator flips inverses direction
+inline Cartesian3 Cartesian3::operator-() const
+    { // Cartesian3::operator -()
+    return Cartesian3(-x, -y, -z);
+    } // Cartesian3::operator -()
+
+// dot product routine
+inline float Cartesian3::dot(const Cartesian3 &other) const
+    { // Cartesian3::dot()
+    return x * other.x + y * other.y + z * other.z;
+    } // Cartesian3::dot()
+
+// cross product routine
+inline Cartesian3 Cartesian3::cross(const Cartesian3 &other) const
+    { // Cartesian3::cross()
+    return Cartesian3(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x);
+    } // Cartesian3::cross()
+
+// routine to find the length
+inline float Cartesian3::length() const
+    { // Cartesian3::length()
+    return std::sqrt(x*x + y*y + z*z);   
+    } // Cartesian3::length()
+
+// normalisation routine
+inline Cartesian3 Cartesian3::unit() const
+    { // Cartesian3::unit()
+    float length = std::sqrt(x*x+y*y+z*z);
+    return Cartesian3(x/length, y/length, z/length);
+    } // Cartesian3::unit()
+
+// operator that allows us to use array indexing instead of variable names
+// use default to catch out of range indices
+// we could throw an exception, but will just return the 0th element instead
+inline float &Cartesian3::operator [] (const int index)
+    { // operator []
+    return (index == 1) ? y : (index == 2) ? z : x;
+    } // operator []
+
+inline const float &Cartesian3::operator [] (const int index) const
+    { // operator []
+    return (index == 1) ? y : (index == 2) ? z : x;
+    } // operator []
+
 // multiplication operator
-Cartesian3 operator *(float factor, const Cartesian3 &right);
+inline Cartesian3 operator *(float factor, const Cartesian3 &right)
+    { // operator *
+    // scalar multiplication is commutative, so flip & return
+    return right * factor;
+    } // operator *
 
 // stream input
 std::istream & operator >> (std::istream &inStream, Cartesian3 &value);
@@ -76,4 +166,4 @@ std::istream & operator >> (std::istream &inStream, Cartesian3 &value);
 // stream output
 std::ostream & operator << (std::ostream &outStream, const Cartesian3 &value);
         
-#endif
\ No newline at end of file
+#endif
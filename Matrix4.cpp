@@ -175,6 +175,42 @@ Matrix4 Matrix4::transpose() const
     return transposeMatrix;
     } // transpose()
 
+// inverse of an affine matrix (bottom row 0 0 0 1)
+Matrix4 Matrix4::affineInverse() const
+    { // affineInverse()
+    // start with the identity so the bottom row is set
+    Matrix4 inverseMatrix;
+    inverseMatrix.SetIdentity();
+
+    // cofactors of the upper 3x3 block, transposed to give the adjugate
+    for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+            inverseMatrix.coordinates[col][row] =
+                coordinates[(row + 1) % 3][(col + 1) % 3] * coordinates[(row + 2) % 3][(col + 2) % 3] -
+                coordinates[(row + 1) % 3][(col + 2) % 3] * coordinates[(row + 2) % 3][(col + 1) % 3];
+
+    // the determinant is the dot product of a row with its cofactors
+    float determinant = 0.0;
+    for (int col = 0; col < 3; col++)
+        determinant += coordinates[0][col] * inverseMatrix.coordinates[col][0];
+
+    // divide the adjugate through by it
+    for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+            inverseMatrix.coordinates[row][col] /= determinant;
+
+    // and the translation is undone after the inverted block is applied
+    for (int row = 0; row < 3; row++)
+        { // per row
+        inverseMatrix.coordinates[row][3] = 0.0;
+        for (int col = 0; col < 3; col++)
+            inverseMatrix.coordinates[row][3] -= inverseMatrix.coordinates[row][col] * coordinates[col][3];
+        } // per row
+
+    // return the result
+    return inverseMatrix;
+    } // affineInverse()
+
 // returns a column-major array of 16 values
 // for use with OpenGL
 columnMajorMatrix Matrix4::columnMajor() const
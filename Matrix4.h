@@ -80,6 +80,10 @@ class Matrix4
     
     // matrix transpose
     Matrix4 transpose() const;
+
+    // inverse of an affine matrix (bottom row 0 0 0 1), by inverting the 
+    // upper 3x3 block and the translation separately
+    Matrix4 affineInverse() const;
     
     // returns a column-major array of 16 values
     // for use with OpenGL
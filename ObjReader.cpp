@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ObjReader.h"
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr)
+        munmap(const_cast<char*>(data_), size_);
+}
+
+// map the file, returns false if it cannot be opened or mapped
+bool MappedFile::Open(const char* path) {
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat status;
+    if (fstat(file, &status) != 0) {
+        close(file);
+        return false;
+    }
+    size_ = status.st_size;
+    // an empty file has nothing to map, it reads as no lines
+    if (size_ == 0) {
+        close(file);
+        return true;
+    }
+    void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+    // the mapping keeps the file alive on its own
+    close(file);
+    if (mapping == MAP_FAILED) {
+        size_ = 0;
+        return false;
+    }
+    // the file is read front to back, once
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(mapping);
+    return true;
+}
+
+// start of the line after the one at cursor
+static const char* NextLine(const char* cursor, const char* end) {
+    const char* newline = static_cast<const char*>(
+        std::memchr(cursor, '\n', end - cursor));
+    return newline == nullptr ? end : newline + 1;
+}
+
+static bool IsBlank(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+// move the cursor past blanks (spaces, tabs and carriage returns)
+const char* SkipBlanks(const char* cursor, const char* end) {
+    while ((cursor < end) && IsBlank(*cursor))
+        cursor++;
+    return cursor;
+}
+
+bool ParseFloat(const char*& cursor, const char* end, float& value) {
+    cursor = SkipBlanks(cursor, end);
+    // from_chars does not take a leading plus
+    if ((cursor < end) && (*cursor == '+'))
+        cursor++;
+    std::from_chars_result result = std::from_chars(cursor, end, value);
+    if (result.ec != std::errc())
+        return false;
+    cursor = result.ptr;
+    return true;
+}
+
+bool ParseInt(const char*& cursor, const char* end, int& value) {
+    cursor = SkipBlanks(cursor, end);
+    if ((cursor < end) && (*cursor == '+'))
+        cursor++;
+    std::from_chars_result result = std::from_chars(cursor, end, value);
+    if (result.ec != std::errc())
+        return false;
+    cursor = result.ptr;
+    return true;
+}
+
+// read up to three coordinates, missing ones are 0
+static Cartesian3 ParseCartesian(const char* cursor, const char* end) {
+    Cartesian3 value(0.0f, 0.0f, 0.0f);
+    if (ParseFloat(cursor, end, value.x) && ParseFloat(cursor, end, value.y))
+        ParseFloat(cursor, end, value.z);
+    return value;
+}
+
+// turn a 1 based index, or a negative one counting back from the last element
+// read, into a 0 based one
+static bool ResolveIndex(int index, unsigned int count, unsigned int& resolved) {
+    if (index > 0)
+        resolved = index - 1;
+    else if ((index < 0) && ((unsigned int) -index <= count))
+        resolved = count + index;
+    else
+        return false;
+    return true;
+}
+
+// cut [begin, end) into at most nChunks runs of whole lines, returns the
+// boundaries with begin first and end last
+std::vector<const char*> SplitLines(const char* begin, const char* end,
+    unsigned int nChunks) {
+    std::size_t size = end - begin;
+    nChunks = std::max<std::size_t>(1, std::min<std::size_t>(nChunks,
+        size / OBJ_MIN_CHUNK_SIZE));
+    std::vector<const char*> boundaries(1, begin);
+    for (unsigned int chunk = 1; chunk < nChunks; chunk++) {
+        // move each even cut on to the start of the next line
+        const char* cut = begin + size * chunk / nChunks;
+        cut = NextLine(std::max(cut, boundaries.back()), end);
+        boundaries.push_back(cut);
+    }
+    boundaries.push_back(end);
+    return boundaries;
+}
+
+// count the lines of each kind in [begin, end), and the triangles they can give
+void ObjChunk::Count(const char* begin, const char* end) {
+    begin_ = begin;
+    end_ = end;
+    vertexCount = normalCount = texCoordCount = faceCount = triangleCount = 0;
+    for (const char* line = begin; line < end; ) {
+        const char* next = NextLine(line, end);
+        const char* cursor = SkipBlanks(line, next);
+        line = next;
+        if (next - cursor < 2)
+            continue;
+        if ((cursor[0] == 'f') && IsBlank(cursor[1])) {
+            faceCount++;
+            // a corner starts after each run of blanks
+            unsigned int corners = 0;
+            for (const char* c = cursor + 1; c + 1 < next; c++)
+                corners += IsBlank(c[0]) && !IsBlank(c[1]) && (c[1] != '\n');
+            triangleCount += (corners > 2) ? corners - 2 : 0;
+        }
+        else if (cursor[0] == 'v') {
+            if (IsBlank(cursor[1]))
+                vertexCount++;
+            else if (cursor[1] == 'n')
+                normalCount++;
+            else if (cursor[1] == 't')
+                texCoordCount++;
+        }
+        else if ((cursor[0] == 'l') && (cursor[1] == 'f'))
+            triangleCount++;
+    }
+}
+
+// parse the counted lines into the target at the chunk's offsets
+void ObjChunk::Parse(const ObjChunkTarget& target) {
+    unsigned int verticesParsed = 0, normalsParsed = 0, texCoordsParsed = 0;
+    trianglesParsed = facesParsed = 0;
+    for (const char* line = begin_; line < end_; ) {
+        const char* next = NextLine(line, end_);
+        // the line without its newline
+        const char* end = next - ((next > line) && (next[-1] == '\n') ? 1 : 0);
+        const char* cursor = SkipBlanks(line, end);
+        line = next;
+        if ((cursor == end) || (*cursor == '#'))
+            continue;
+
+        switch (*cursor) {
+            // Count found exactly these lines, so they fill their room
+            case 'v':
+                if (end - cursor < 2)
+                    break;
+                if (IsBlank(cursor[1]))
+                    target.vertices[target.vertexOffset + verticesParsed++] =
+                        ParseCartesian(cursor + 1, end);
+                else if (cursor[1] == 'n')
+                    target.normals[target.normalOffset + normalsParsed++] =
+                        ParseCartesian(cursor + 2, end);
+                else if (cursor[1] == 't')
+                    target.textureCoords[target.texCoordOffset + texCoordsParsed++] =
+                        ParseCartesian(cursor + 2, end);
+                break;
+            case 'f':
+                if ((end - cursor >= 2) && IsBlank(cursor[1]))
+                    ParseFace(cursor + 1, end, target, verticesParsed, normalsParsed,
+                        texCoordsParsed);
+                break;
+            // colours, textures, lights and materials depend on what came
+            // before them in the file, so they wait for the merge
+            case 'c':
+            case 't':
+            case 'l':
+            case 'm': {
+                bool areaLightFace = (cursor[0] == 'l') && (end - cursor >= 2) &&
+                    (cursor[1] == 'f') && (trianglesParsed < triangleCount);
+                directives.push_back(ObjDirective{cursor, end, trianglesParsed,
+                    areaLightFace});
+                if (areaLightFace)
+                    trianglesParsed++;
+                break;
+            }
+            // default processing: do nothing
+            default:
+                break;
+        }
+    }
+}
+
+// read the corners of a face line and fan it out into triangles
+void ObjChunk::ParseFace(const char* cursor, const char* end,
+    const ObjChunkTarget& target, unsigned int verticesParsed,
+    unsigned int normalsParsed, unsigned int texCoordsParsed) {
+    // corners are v, v/t, v//n or v/t/n, missing indices are marked as such
+    unsigned int first[3] = {}, previous[3] = {}, corner[3];
+    unsigned int nCorners = 0;
+    int index;
+    while (ParseInt(cursor, end, index)) {
+        // a vertex past the end of the object's ends the face, texture
+        // coordinates and normals past theirs are pointed at defaults later
+        if (!ResolveIndex(index, target.vertexOffset + verticesParsed, corner[0]) ||
+            (corner[0] >= target.vertexTotal))
+            break;
+        corner[1] = corner[2] = OBJ_NO_INDEX;
+        if ((cursor < end) && (*cursor == '/')) {
+            cursor++;
+            if ((cursor < end) && (*cursor != '/') && ParseInt(cursor, end, index) &&
+                !ResolveIndex(index, target.texCoordOffset + texCoordsParsed, corner[1]))
+                break;
+            if ((cursor < end) && (*cursor == '/')) {
+                cursor++;
+                if (ParseInt(cursor, end, index) &&
+                    !ResolveIndex(index, target.normalOffset + normalsParsed, corner[2]))
+                    break;
+            }
+        }
+
+        // fan out starting at the first corner, as far as Count left room
+        if (nCorners == 0)
+            std::copy(corner, corner + 3, first);
+        else if (nCorners >= 2) {
+            if (trianglesParsed == triangleCount)
+                break;
+            Triangle& triangle = target.triangles[target.triangleOffset + trianglesParsed++];
+            triangle.vertices[0] = first[0];
+            triangle.texCoords[0] = first[1];
+            triangle.normals[0] = first[2];
+            triangle.vertices[1] = previous[0];
+            triangle.texCoords[1] = previous[1];
+            triangle.normals[1] = previous[2];
+            triangle.vertices[2] = corner[0];
+            triangle.texCoords[2] = corner[1];
+            triangle.normals[2] = corner[2];
+        }
+        std::copy(corner, corner + 3, previous);
+        nCorners++;
+    }
+
+    // keep the number of triangles in a face for writing object to file
+    if (nCorners > 2)
+        target.faceTriangles[target.faceOffset + facesParsed++] = nCorners - 2;
+}
@@ -0,0 +1,134 @@
+#ifndef OBJREADER_H
+#define OBJREADER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "Cartesian3.h"
+#include "Utils.h"
+
+// files smaller than this are parsed as a single chunk, splitting them costs
+// more than it saves
+constexpr std::size_t OBJ_MIN_CHUNK_SIZE = 1 << 16;
+// a texture coordinate or normal index a face corner left out, it is pointed
+// at a default one once the whole file is read
+constexpr unsigned int OBJ_NO_INDEX = 0xffffffffu;
+
+// a read only memory mapping of a whole file
+class MappedFile {
+    public:
+        MappedFile() : data_(nullptr), size_(0) {}
+        ~MappedFile();
+
+        // map the file, returns false if it cannot be opened or mapped
+        bool Open(const char* path);
+
+        const char* Data() const { return data_; }
+        std::size_t Size() const { return size_; }
+
+    private:
+        // the mapping is unmapped once, so it cannot be copied
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data_;
+        std::size_t size_;
+};
+
+// the reader's current settings, changed by the directives and stamped on the
+// faces that follow them
+struct ObjReadState {
+    // id of the next triangle and of the next area light
+    unsigned int id = 0;
+    unsigned int lightId = 1;
+    // current colour, material and texture (0 means "don't use texture")
+    unsigned int colour = 0;
+    unsigned int material = 0;
+    unsigned int texture = 0;
+    // intensity of the area lights that follow
+    RGBRadiance areaLightIntensity;
+    // where the next face goes, the faces are parsed into place with room
+    // that may go unused, so this is never after the next parsed face
+    unsigned int face = 0;
+};
+
+// a line holding one of the directives that change the reader's state
+// (colours, textures, lights and materials). Directives are replayed in file
+// order once every chunk is parsed, position is the number of the chunk's
+// triangles before the directive
+struct ObjDirective {
+    const char* begin;
+    const char* end;
+    unsigned int position;
+    // whether the line is an area light triangle, which is left a place at
+    // position among the chunk's triangles
+    bool areaLightFace;
+};
+
+// where a chunk writes what it parses. The arrays are the whole object's, and
+// the offsets are where the chunk's part of each starts
+struct ObjChunkTarget {
+    Cartesian3* vertices;
+    Cartesian3* normals;
+    Cartesian3* textureCoords;
+    Triangle* triangles;
+    // triangles per face line, for writing the object back out
+    unsigned int* faceTriangles;
+    // vertices, normals and texture coordinates before the chunk, which
+    // negative (relative) indices count back from
+    unsigned int vertexOffset, normalOffset, texCoordOffset;
+    unsigned int triangleOffset, faceOffset;
+    // vertices of the whole object, faces using one past them are rejected
+    unsigned int vertexTotal;
+};
+
+// the geometry read from a run of whole lines of an OBJ file. Triangles only
+// get their indices here, the state dependent fields are set when the chunks
+// are merged
+class ObjChunk {
+    public:
+        ObjChunk() : vertexCount(0), normalCount(0), texCoordCount(0), faceCount(0),
+            triangleCount(0), trianglesParsed(0), facesParsed(0),
+            begin_(nullptr), end_(nullptr) {}
+
+        // count the lines of each kind in [begin, end), and the triangles
+        // they can give
+        void Count(const char* begin, const char* end);
+
+        // parse the counted lines into the target at the chunk's offsets
+        void Parse(const ObjChunkTarget& target);
+
+    public:
+        // lines of each kind found by Count, and room for the triangles: two
+        // fewer than the corners of each face line, and one per area light
+        unsigned int vertexCount, normalCount, texCoordCount, faceCount, triangleCount;
+        // triangles and face lines Parse wrote. Lines that stop early or give
+        // no triangle leave some of the room unused
+        unsigned int trianglesParsed, facesParsed;
+
+        std::vector<ObjDirective> directives;
+
+    private:
+        // read the corners of a face line and fan it out into triangles
+        void ParseFace(const char* cursor, const char* end, const ObjChunkTarget& target,
+            unsigned int verticesParsed, unsigned int normalsParsed,
+            unsigned int texCoordsParsed);
+
+        const char* begin_;
+        const char* end_;
+};
+
+// cut [begin, end) into at most nChunks runs of whole lines, returns the
+// boundaries with begin first and end last
+std::vector<const char*> SplitLines(const char* begin, const char* end,
+    unsigned int nChunks);
+
+// number parsing within a line, each skips leading blanks, moves the cursor
+// past the number and returns false if there was none
+bool ParseFloat(const char*& cursor, const char* end, float& value);
+bool ParseInt(const char*& cursor, const char* end, int& value);
+
+// move the cursor past blanks (spaces, tabs and carriage returns)
+const char* SkipBlanks(const char* cursor, const char* end);
+
+#endif
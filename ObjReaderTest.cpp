@@ -0,0 +1,79 @@
+// c++ default libraries
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "RayTracer.h"
+#include "RenderParameters.h"
+#include "RGBAImage.h"
+#include "TexturedObject.h"
+
+// whether every corner of every face indexes the object's arrays
+static bool IndicesValid(const TexturedObject& object) {
+    for (const Triangle& face : object.faces)
+        for (unsigned int corner = 0; corner < 3; corner++)
+            if ((face.vertices[corner] >= object.vertices.size()) ||
+                (face.texCoords[corner] >= object.textureCoords.size()) ||
+                (face.normals[corner] >= object.normals.size()))
+                return false;
+    return true;
+}
+
+// read an object from text, then render it so every index the renderer
+// follows is used, returns false with a message if anything is wrong
+static bool CheckObject(const char* name, const std::string& geometry,
+    unsigned int expectedFaces) {
+    TexturedObject object;
+    std::istringstream geometryStream(geometry), textureStream("");
+    if (!object.ReadObjectStream(geometryStream, textureStream)) {
+        std::cerr << name << ": read failed" << std::endl;
+        return false;
+    }
+    if (object.faces.size() != expectedFaces) {
+        std::cerr << name << ": read " << object.faces.size() << " faces, expected "
+            << expectedFaces << std::endl;
+        return false;
+    }
+    if (!IndicesValid(object)) {
+        std::cerr << name << ": a face indexes past the object's arrays" << std::endl;
+        return false;
+    }
+
+    RenderParameters renderParameters;
+    RGBAImage frameBuffer;
+    frameBuffer.Resize(16, 16);
+    RayTracer rayTracer(&frameBuffer, &renderParameters, &object, 1);
+    rayTracer.RayTraceImage();
+    return true;
+}
+
+// reads objects whose faces leave out texture coordinates or normals, or use
+// vertices that are not there
+int main() {
+    // a tetrahedron around the origin, in front of the default eye
+    const std::string vertices =
+        "lp 0 3 3 1 0\n"
+        "v 0.5 0.5 0.5\nv -0.5 -0.5 0.5\nv -0.5 0.5 -0.5\nv 0.5 -0.5 -0.5\n";
+    bool passed = true;
+    // only v lines, and a polygon fanned into two triangles
+    passed &= CheckObject("vertices only", vertices +
+        "f 1 2 3\nf 1 3 4\nf 1 4 2 3\n", 4);
+    // texture coordinates but no normals, and the other way round
+    passed &= CheckObject("no normals", vertices +
+        "vt 0 0\nvt 1 0\nvt 0 1\n"
+        "f 1/1 2/2 3/3\nf 1/1 3/3 4/2\nf 2/1 4/2 3/3\n", 3);
+    passed &= CheckObject("no texture coordinates", vertices +
+        "vn 0 0 1\n"
+        "f 1//1 2//1 3//1\nf -4//-1 -2//-1 -1//-1\n", 2);
+    // a mix of corners within one face
+    passed &= CheckObject("mixed corners", vertices +
+        "vt 0 0\nvn 0 0 1\n"
+        "f 1/1/1 2//1 3/1 4\n", 2);
+    // vertices past the end of the file's, a face stops at the first one
+    passed &= CheckObject("vertex out of range", vertices +
+        "f 1 2 99999999\nf 1 2 3 5\nlf 1 2 99\n", 1);
+
+    std::cout << (passed ? "All object reader tests passed" :
+        "Object reader tests failed") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -12,7 +12,7 @@
 //  
 //  A minimal class for an image in single-byte RGBA format
 //  Optimized for simplicity, not speed or memory
-//  With read/write for ASCII RGBA files
+//  With read/write for ASCII and binary PPM files
 //  
 
 #define MAX_IMAGE_DIMENSION 4096
@@ -23,6 +23,7 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
 #include "string.h"
 
 #include "RGBAImage.h"
@@ -175,9 +176,10 @@ bool RGBAImage::ReadPPM(std::istream &inStream)
     inStream.getline(lineBuffer, MAX_LINE_LENGTH);
     
     // check for magic number (file code) in first two characters
-    if (strcmp(lineBuffer,"P3") != 0)
+    bool binary = (strcmp(lineBuffer,"P6") == 0);
+    if (!binary && (strcmp(lineBuffer,"P3") != 0))
         { // failed read
-        std::cerr << "RGBA stream did not start with PPM code (P3)" << std::endl;
+        std::cerr << "RGBA stream did not start with PPM code (P3 or P6)" << std::endl;
         return false;
         } // failed read
 
@@ -209,6 +211,22 @@ bool RGBAImage::ReadPPM(std::istream &inStream)
     // resize the image
     Resize(newWidth, newHeight);
 
+    if (binary)
+        { // binary
+        // a single whitespace character separates the header from the bytes
+        inStream.get();
+        // read every pixel in one go, then spread them out with alpha added
+        std::vector<unsigned char> bytes(3 * width * height);
+        if (!inStream.read((char *) bytes.data(), bytes.size()))
+            { // short read
+            std::cerr << "RGBA stream ended before the end of the image" << std::endl;
+            return false;
+            } // short read
+        for (long pixel = 0; pixel < width * height; pixel++)
+            block[pixel] = RGBAValue(bytes[3 * pixel], bytes[3 * pixel + 1], bytes[3 * pixel + 2]);
+        return true;
+        } // binary
+
     // loop through pixels, reading them:
     for (int row = 0; row < height; row++)
         for (int col = 0; col < width; col++)       
@@ -219,13 +237,27 @@ bool RGBAImage::ReadPPM(std::istream &inStream)
     } // ReadPPMFile()
 
 // file write routine
-void RGBAImage::WritePPM(std::ostream &outStream)
+void RGBAImage::WritePPM(std::ostream &outStream, bool binary)
     { // WritePPMFile()
     // print out header information
-    outStream << "P3" << std::endl;
+    outStream << (binary ? "P6" : "P3") << std::endl;
     outStream << "# PPM File" << std::endl;
     outStream << width << " " << height << std::endl;
     outStream << 255 << std::endl;
+
+    if (binary)
+        { // binary
+        // drop alpha and write every pixel in a single call
+        std::vector<unsigned char> bytes(3 * width * height);
+        for (long pixel = 0; pixel < width * height; pixel++)
+            { // pixel
+            bytes[3 * pixel] = block[pixel].red;
+            bytes[3 * pixel + 1] = block[pixel].green;
+            bytes[3 * pixel + 2] = block[pixel].blue;
+            } // pixel
+        outStream.write((const char *) bytes.data(), bytes.size());
+        return;
+        } // binary
         
     // loop through pixels, reading them:
     for (int row = 0; row < height; row++)
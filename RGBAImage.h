@@ -12,7 +12,7 @@
 //  
 //  A minimal class for an image in single-byte RGBA format
 //  Optimized for simplicity, not speed or memory
-//  With read/write for ASCII RGBA files
+//  With read/write for ASCII and binary PPM files
 //  
 ///////////////////////////////////////////////////
 
@@ -57,9 +57,10 @@ class RGBAImage
     // if the flag is not set, it will use nearest neighbour
     RGBAValue GetTexel(float u, float v, bool bilinearFiltering);
 
-    // routines for stream read & write
+    // routines for stream read & write, reading takes ASCII (P3) or binary
+    // (P6) files, binary streams should be opened with std::ios::binary
     bool ReadPPM(std::istream &inStream);
-    void WritePPM(std::ostream &outStream);
+    void WritePPM(std::ostream &outStream, bool binary = false);
     
     }; // class RGBAImage
 
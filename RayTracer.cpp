@@ -2,7 +2,8 @@
 #include <limits>
 #include <cmath>
 #include <chrono>
-#include <thread>
+#include <algorithm>
+#include <atomic>
 
 #include "RayTracer.h"
 #include "Matrix4.h"
@@ -10,30 +11,88 @@
 
 // pointer argument to directly modify the frame buffer in the widget
 void RayTracer::RayTraceImage() {
-    unsigned int availableThreads = std::thread::hardware_concurrency();
-    // arbitrary position for the eye (movable with a slider?)
-    Cartesian3 eyePos(0, 0, 3);
+    BeginRender();
+    
+    if (parameters_->showObject) {
+        // start timer
+        auto start = std::chrono::high_resolution_clock::now();
+
+        if (parameters_->adaptiveSampling)
+            TraceAdaptive();
+        else
+            TraceSamples(nSamples_);
+        Resolve();
+
+        // end timer
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Render took: " << 
+            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() 
+            << "ms." << std::endl;
+    }
+
+    EndRender();
+}
+
+// start a progressive render, the transforms and buffer are set up once and
+// each pass then adds to them
+void RayTracer::BeginProgressive() {
+    EndRender();
+    BeginRender();
+    // a progressive render can be stopped after any pass, so only one sample
+    // per pixel is sure to be taken and the light is sampled at random
+    lightStrata_ = 1;
+}
+
+// trace one more sample per pixel and show the running average, returns false
+// once no pixel needs more samples
+bool RayTracer::ProgressivePass() {
+    if ((pixelBuffer_ == nullptr) || !parameters_->showObject)
+        return false;
+    unsigned long taken = TraceSamples(1);
+    Resolve();
+    return taken > 0;
+}
+
+// finish a progressive render, the frame buffer keeps the last average
+void RayTracer::EndProgressive() {
+    EndRender();
+}
+
+// set up the transforms and an empty radiance buffer for a render
+void RayTracer::BeginRender() {
+    // the eye looks at the image plane z = 1 from its position
+    eyePos_ = parameters_->eyePosition;
     
     // get number of samples from parameters
     nSamples_ = parameters_->samples_;
+    samplesTaken_ = 0;
+    unsigned int samples = (unsigned int) nSamples_;
+    // side of the largest square grid of light strata that every pixel's 
+    // samples fill, a grid left part filled would bias the pixel towards the
+    // strata it has
+    lightStrata_ = (unsigned int) std::sqrt(samples);
+    // adaptive sampling spends half of the samples on a grid for every pixel
+    // to estimate its error from, then adds whole grids to the pixels that 
+    // need them, never giving one more than a few times the average
+    if (parameters_->adaptiveSampling)
+        lightStrata_ = std::max(1u, (unsigned int) std::sqrt(samples / 2));
+    minSamples_ = lightStrata_ * lightStrata_;
+    maxSamples_ = ADAPTIVE_MAX_FACTOR * samples;
     
-    // initialise the random number generator seed with current time
-    generator_ = std::default_random_engine(
-        std::chrono::system_clock::now().time_since_epoch().count());
-
     // scale for vertices
     float scale = parameters_->zoomScale;
     if (parameters_->scaleObject)
         scale /= object_->objectSize;
 
-    // compute the transforms affecting the model
-    Matrix4 objectTransform;
-    objectTransform = GetTransform(false, scale);
-    // then apply it to the model's vertices here once, rather than every time we
-    // test a triangle later
-    for (unsigned int vertex = 0; vertex < object_->vertices.size(); vertex++) {
-        object_->vertices[vertex] = objectTransform * object_->vertices[vertex] * scale;
-    }
+    // compute the transforms affecting the model. Rather than moving the 
+    // vertices, rays are taken into object space for intersection tests, so
+    // the object and its hierarchy are never modified by a render
+    Matrix4 scaleTransform;
+    scaleTransform.SetScale(scale, scale, scale);
+    objectToWorld_ = scaleTransform * GetTransform(scale);
+    worldToObject_ = objectToWorld_.affineInverse();
+    // and the instances placed in the object's space, refitted if they moved
+    scene_.Update();
 
     // compute aspect ratio from frame buffer dimensions
     height_ = frameBuffer_->height;
@@ -55,135 +114,209 @@ void RayTracer::RayTraceImage() {
             else
                 pixelBuffer_[i*width_+j].worldPos.x *= aspectRatio;
             pixelBuffer_[i*width_+j].radiance = RGBRadiance();
+            pixelBuffer_[i*width_+j].isLight = false;
+            pixelBuffer_[i*width_+j].samples = 0;
+            pixelBuffer_[i*width_+j].mean = 0.0f;
+            pixelBuffer_[i*width_+j].m2 = 0.0f;
         }
-    
-    if (parameters_->showObject) {
-        // divide up the image (very crudely done here, ideally  should afford 
-        // less rows to the thread if ray intersects a lot of geometry, use opengl
-        // image as a guide?)
-        unsigned long const rowsPerThread = frameBuffer_->height / availableThreads;
-        unsigned long firstRow = 0;
-        // create a container for the threads
-        std::vector<std::thread> threads(availableThreads - 1);
-
-        // start timer
-        auto start = std::chrono::high_resolution_clock::now();
+}
 
-        // loop over available threads, minus the current thread
-        for (unsigned int thread = 0; thread < availableThreads - 1; thread++) {
-            // create a thread and pass a reference to this raytracer class and 
-            // call the raytrace pixels function with the assigned pixel rows
-            threads[thread] = std::thread(
-                &RayTracer::RayTracePixelsThread, this, firstRow, rowsPerThread, eyePos);
-            firstRow += rowsPerThread;
-        }
-        // also use the current thread
-        if (frameBuffer_->height % 2)
-            RayTracePixelsThread(firstRow, rowsPerThread + 1, eyePos);
-        else
-            RayTracePixelsThread(firstRow, rowsPerThread, eyePos);
-
-        // join up threads
-        for (unsigned int thread = 0; thread < availableThreads - 1; thread++)
-            threads[thread].join();
-
-        // now set the RGBImage with radiance buffer values, also divide by samples
-        for (long i = 0; i < height_; i++)
-            for (long j = 0; j < width_; j++) 
-                frameBuffer_->block[i*width_+j] = 
-                    (pixelBuffer_[i*width_+j].radiance / nSamples_).ToRGBAValue();
-
-        Ray ray = Ray();
-        Surfel surfel;
-        ray.origin_ = eyePos;
-        // Add a final pass to set the ligh pixels
-        for (long i = 0; i < height_; i++)
-            for (long j = 0; j < width_; j++) {
-                // ray from eye to infinity passing through the pixel in world space
-                // compute the radiance of the pixel
-                ray.direction_ = (pixelBuffer_[i*width_+j].worldPos - eyePos).unit();
-                // create a surfel at the intersection point of the ray with the scene
-                if (!ClosestTriangleIntersect(ray, &surfel))
-                    continue;
-                
-                if (surfel.triangle_->lightId != 0)
-                    frameBuffer_->block[i*width_+j] = RGBAValue(255.0f, 255.0f, 255.0f);
+// free the radiance buffer of a render
+void RayTracer::EndRender() {
+    free(pixelBuffer_);
+    pixelBuffer_ = nullptr;
+}
 
-            }
+// add count samples to every pixel of the buffer that needs them, returns the
+// number of samples taken
+unsigned long RayTracer::TraceSamples(unsigned int count) {
+    // cut the image into small tiles that the workers take from their own 
+    // queue and steal from each other, so all cores stay busy until the 
+    // last tile whatever geometry each one hits
+    TileScheduler scheduler(width_, height_, threadPool_.Size());
+
+    // run the workers of the pool, the calling thread included
+    std::atomic<unsigned long> taken(0);
+    threadPool_.Run([&](unsigned int worker) {
+        Tile tile;
+        unsigned long workerTaken = 0;
+        while (scheduler.NextTile(worker, tile))
+            workerTaken += RayTraceTile(tile, count);
+        taken += workerTaken;
+    });
+    samplesTaken_ += count;
+    return taken;
+}
 
-        // end timer
-        auto end = std::chrono::high_resolution_clock::now();
-        std::cout << "Render took: " << 
-            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() 
-            << "ms." << std::endl;
+// spread the render's samples over the pixels that need them most. Every pixel
+// first gets a grid of samples to estimate its error from, then rounds of one 
+// grid each go to the pixels whose error is still above the threshold, until
+// the budget of the requested samples per pixel is spent (the last round can 
+// go over it) or every pixel is below the threshold
+void RayTracer::TraceAdaptive() {
+    unsigned long budget = (unsigned long) nSamples_ * width_ * height_;
+    unsigned long taken = 0;
+    while (taken < budget) {
+        unsigned long roundTaken = TraceSamples(minSamples_);
+        if (roundTaken == 0)
+            break;
+        taken += roundTaken;
     }
+    std::cout << "Adaptive sampling took " << (float) taken / (width_ * height_) 
+        << " samples per pixel." << std::endl;
+}
 
-    // free memory
-    free(pixelBuffer_);
+// whether a pixel takes part in the next round of samples
+bool RayTracer::NeedsSamples(const Pixel& pixel) const {
+    if (!parameters_->adaptiveSampling || (pixel.samples < minSamples_))
+        return true;
+    // pixels seeing an area light are painted white whatever their samples
+    if (pixel.isLight || (pixel.samples >= maxSamples_))
+        return false;
+    return pixel.DisplayError() > parameters_->adaptiveThreshold;
+}
 
-    // now compute the inverse transform affecting the model
-    objectTransform = GetTransform(true, scale);
-    // then apply it to the model's vertices to undo the previous transform
-    for (unsigned int vertex = 0; vertex < object_->vertices.size(); vertex++) {
-        object_->vertices[vertex] = objectTransform * object_->vertices[vertex] / scale;
-    }
+// set the RGBImage with radiance buffer values, each worker converting an
+// equal band of rows
+void RayTracer::Resolve() {
+    unsigned int nWorkers = threadPool_.Size();
+    threadPool_.Run([&](unsigned int worker) {
+        ResolveRows(height_ * worker / nWorkers, height_ * (worker + 1) / nWorkers);
+    });
 }
 
-// a sub function that renders a section of the image
-void RayTracer::RayTracePixelsThread(
-    const long& begin, const long& rows, const Cartesian3& eyePos) {
-    RGBRadiance pixelRadiance;
+// a sub function that adds count samples to the pixels of a tile that need
+// them, returns the number of samples taken
+unsigned long RayTracer::RayTraceTile(const Tile& tile, unsigned int count) {
+    unsigned long taken = 0;
     Ray ray = Ray();
-    ray.origin_    = eyePos;
-    // loop as many samples as desired
-    for(unsigned int sample = 0; sample < nSamples_; sample++) { 
-        // loop over pixels
-        for (long i = begin; i < begin + rows; i++)
-            for (long j = 0; j < width_; j++) {
-                // ray from eye to infinity passing through the pixel in world space
-                // compute the radiance of the pixel
-                ray.direction_ = (pixelBuffer_[i*width_+j].worldPos - eyePos).unit();
-                int depth = 0;
-                pixelRadiance = PathTrace(ray, RGBRadiance(1.0f,1.0f,1.0f), ++depth);
-
-                // accumulate radiance at the pixel
-                pixelBuffer_[i*width_+j].radiance = 
-                    pixelBuffer_[i*width_+j].radiance + pixelRadiance;
+    ray.origin_    = eyePos_;
+    // this worker's random numbers, reseeded for every pixel and sample
+    RandomGenerator rng;
+    // loop over pixels
+    for (long i = tile.rowBegin; i < tile.rowEnd; i++)
+        for (long j = tile.colBegin; j < tile.colEnd; j++) {
+            Pixel& pixel = pixelBuffer_[i*width_+j];
+            if (!NeedsSamples(pixel))
+                continue;
+            taken += count;
+            // ray from eye to infinity passing through the pixel in world space
+            ray.direction_ = (pixel.worldPos - eyePos_).unit();
+
+            // the eye ray is the same for every sample, so find its first hit and
+            // the surfel's properties once and start every sample's path there.
+            // All samples of a pixel are traced back to back, so this surfel is 
+            // the pixel's whole first hit buffer
+            Surfel primaryHit;
+            if (!ClosestTriangleIntersect(ray, &primaryHit)) {
+                // nothing hit, every sample is 0
+                for (unsigned int sample = 0; sample < count; sample++)
+                    pixel.AddSample(RGBRadiance());
+                continue;
+            }
+            primaryHit.InterpolateProperties(parameters_);
+            // record emitter hits here rather than tracing the eye rays again
+            pixel.isLight = primaryHit.isLight_;
+
+            // loop as many samples as desired, carrying on from the pixel's last
+            unsigned int sampleBegin = pixel.samples;
+            for(unsigned int sample = sampleBegin; sample < sampleBegin + count; sample++) { 
+                // the sequence only depends on the seed, pixel and sample
+                rng.Seed(RandomGenerator::PixelSeed(parameters_->seed, i*width_+j, sample));
+                // adaptive rounds each fill the grid of light strata again,
+                // otherwise samples past it are random
+                unsigned int stratum = parameters_->adaptiveSampling ? 
+                    sample % minSamples_ : sample;
+                // accumulate the radiance of the sample at the pixel
+                pixel.AddSample(PathTrace(primaryHit, -ray.direction_, rng, stratum));
             }
+        }
+    return taken;
+}
+
+
+// fill the table that replaces pow when converting radiance to bytes, each 
+// step holds the conversion of its middle and the last entry that of 1
+void RayTracer::BuildGammaTable() {
+    for (unsigned int entry = 0; entry <= GAMMA_TABLE_SIZE; entry++) {
+        float radiance = std::min(1.0f, (entry + 0.5f) / GAMMA_TABLE_SIZE);
+        gammaTable_[entry] = RGBRadiance(radiance, radiance, radiance).ToRGBAValue().red;
     }
 }
 
+// index of the table entry for a scaled radiance, anything from 1 up is 
+// saturated and NaNs fall to 0
+static inline unsigned int GammaIndex(float scaled) {
+    return (unsigned int) std::max(0.0f, std::min(scaled, (float) GAMMA_TABLE_SIZE));
+}
 
-// returns the radiance for a ray  
-RGBRadiance RayTracer::PathTrace(const Ray& ray, const RGBRadiance& combinedAlbedo, int& depth) {
+// average the samples of a band of rows and write them to the frame buffer
+void RayTracer::ResolveRows(long rowBegin, long rowEnd) {
+    for (long pixel = rowBegin * width_; pixel < rowEnd * width_; pixel++) {
+        const Pixel& source = pixelBuffer_[pixel];
+        // divides by the pixel's samples and scales to the table in one go
+        float scale = source.samples > 0 ? (float) GAMMA_TABLE_SIZE / source.samples : 0.0f;
+        // paint the pixels that see an area light white
+        if (source.isLight)
+            frameBuffer_->block[pixel] = RGBAValue(255.0f, 255.0f, 255.0f, 255.0f);
+        else
+            frameBuffer_->block[pixel] = RGBAValue(
+                gammaTable_[GammaIndex(source.radiance.red_ * scale)],
+                gammaTable_[GammaIndex(source.radiance.green_ * scale)],
+                gammaTable_[GammaIndex(source.radiance.blue_ * scale)]);
+    }
+}
+
+// returns the radiance leaving a surfel in a given direction, following the 
+// path bounce by bounce until it is absorbed, escapes or reaches the maximum depth
+RGBRadiance RayTracer::PathTrace(const Surfel& firstHit, const Cartesian3& firstOutDir,
+    RandomGenerator& rng, int stratum) {
     // initialise with a radiance of 0
     RGBRadiance totalRadiance;
-    // initialise the surfel
-    Surfel surfel;
-
-    // test for albedo termination
-    if (combinedAlbedo.RadianceSum() < EPSILON)
-        return totalRadiance;
+    // product of the albedos along the path, scales the light found at each hit
+    RGBRadiance throughput(1.0f, 1.0f, 1.0f);
+
+    Surfel surfel = firstHit;
+    Cartesian3 outDir = firstOutDir;
+    for (unsigned int depth = 1; ; depth++) {
+        // compute lighting 
+        for (unsigned int light = 0; light < object_->lights.size(); light++) {
+            totalRadiance = totalRadiance + throughput * DirectLight(surfel, 
+                outDir, *object_->lights[light], rng, stratum);
+        }
+        // only the pixel's first hit is shared by its samples
+        stratum = -1;
 
-    // create a surfel at the intersection point of the ray with the scene
-    if (!ClosestTriangleIntersect(ray, &surfel)) {
-        // returns true if invalid (no triangle, so return 0 radiance)
-        return totalRadiance;
-    }
+        if (depth >= parameters_->maxDepth)
+            break;
 
-    // interpolate surfel properies using barycentric coordinates
-    surfel.InterpolateProperties(object_, parameters_);
+        // ambient light
+        Cartesian3 inDir;
+        RGBRadiance albedo;
+        if (!SampleIndirect(surfel, outDir, rng, inDir, albedo))
+            break;
+        throughput = throughput * albedo;
+
+        // past the first few bounces, end paths at random with a probability 
+        // that grows as their throughput falls and boost the survivors to 
+        // compensate, so dim paths stop early without biasing the image
+        if (depth >= parameters_->rouletteDepth) {
+            float survival = std::min(1.0f, throughput.MaxComponent());
+            if (rng.NextFloat() >= survival)
+                break;
+            throughput = throughput / survival;
+        }
 
-    // compute lighting 
-    for (unsigned int light = 0; light < object_->lights.size(); light++) {
-        totalRadiance = totalRadiance + DirectLight(surfel, -ray.direction_, 
-            *object_->lights[light]);
+        // create a surfel at the intersection point of the ray with the scene
+        Surfel nextHit;
+        if (!ClosestTriangleIntersect(Ray(surfel.position_, inDir), &nextHit))
+            break; // nothing hit, no more light
+        // interpolate surfel properies using barycentric coordinates
+        nextHit.InterpolateProperties(parameters_);
+        surfel = nextHit;
+        outDir = -inDir;
     }
 
-    // ambient light
-    totalRadiance = totalRadiance + IndirectLight(surfel, -ray.direction_, 
-        combinedAlbedo, depth);
-
     // set textures if triangle is textured
     //if (parameters_->texturedRendering && surfel.triangle_->texID) {
         // get texture and set outgoing radiance to texture colour, should be
@@ -202,125 +335,276 @@ RGBRadiance RayTracer::PathTrace(const Ray& ray, const RGBRadiance& combinedAlbe
 
 // returns the compound transform that encodes how the object has been transformed
 // by the user through the UI
-Matrix4 RayTracer::GetTransform(const bool& inverse, const float& scale) {
+Matrix4 RayTracer::GetTransform(const float& scale) {
     // a matrix where all the transformations are stored
     Matrix4 renderTransform;
     renderTransform.SetIdentity();
 
-    if (inverse) {
-        // first apply centring translation
-        if (parameters_->centreObject) {
-            Matrix4 centreTransform;
-            centreTransform.SetTranslation(object_->centreOfGravity * scale);
-            renderTransform = renderTransform * centreTransform;
-        }        
-        // then apply transpose of model arcball rotation 
-        renderTransform = parameters_->rotationMatrix.transpose() * renderTransform;
-        // finally apply x y translations
-        Matrix4 translations;
-        translations.SetTranslation(
-            Cartesian3(parameters_->xTranslate, parameters_->yTranslate, 0.0f));
-        renderTransform = translations * renderTransform;
-    }
-    else {        
-        // first apply slider x and y translation
-        Matrix4 translations;
-        translations.SetTranslation(
-            Cartesian3(parameters_->xTranslate, parameters_->yTranslate, 0.0f));
-        renderTransform = translations * renderTransform;
-
-        // then apply model arcball rotation 
-        renderTransform = parameters_->rotationMatrix * renderTransform;
-
-        // finally apply the centre transform
-        if (parameters_->centreObject) {
-            Matrix4 centreTransform;
-            centreTransform.SetTranslation(object_->centreOfGravity * -scale);
-            renderTransform = renderTransform * centreTransform;
-        }
+    // first apply slider x and y translation
+    Matrix4 translations;
+    translations.SetTranslation(
+        Cartesian3(parameters_->xTranslate, parameters_->yTranslate, 0.0f));
+    renderTransform = translations * renderTransform;
+
+    // then apply model arcball rotation 
+    renderTransform = parameters_->rotationMatrix * renderTransform;
+
+    // finally apply the centre transform
+    if (parameters_->centreObject) {
+        Matrix4 centreTransform;
+        centreTransform.SetTranslation(object_->centreOfGravity * -scale);
+        renderTransform = renderTransform * centreTransform;
     }
     // return compound transformation
     return renderTransform;
 }
 
+// takes a world space ray into object space. The direction is not renormalised
+// so the ray parameter t is the same in both spaces
+Ray RayTracer::WorldToObject(const Ray& ray) const {
+    return Ray(worldToObject_ * ray.origin_, (worldToObject_ * 
+        Homogeneous4(ray.direction_.x, ray.direction_.y, ray.direction_.z, 0.0f)).Vector());
+}
+
 // computes the closest triangle along the ray and returns the ray's intersection
 // with the triangle as a surfel
 bool RayTracer::ClosestTriangleIntersect(const Ray& ray, Surfel* surfel) {
     // initialise an empty surfel that does not belong to a triangle
     // start with distance to eye as infinity
     surfel->distanceToEye = std::numeric_limits<float>::infinity();    
-    Cartesian3 v0, v1, v2, u, v, w, normal, intersect;
-    for (unsigned int tri = 0; tri < object_->faces.size(); tri++) {
-        // construct a plane from the triangle
-        v0 = object_->vertices[object_->faces[tri]->vertices[0]];
-        v1 = object_->vertices[object_->faces[tri]->vertices[1]];
-        v2 = object_->vertices[object_->faces[tri]->vertices[2]];
-        // vector u from vertex 0 to 1
-        u = v1 - v0;
-        // vector w from vertex 1 to 2
-        v = v2 - v1;
-        // vector v from vertex 2 to 0
-        w = v0 - v2;
-        // cross product of u and -w gives plane normal
-        normal = u.cross(-w).unit(); 
-
-        // ray is parallel to plane so definitely no intersection, also skip back facing normals
-        float rayDotNormal = ray.direction_.dot(normal);
-        if (rayDotNormal > EPSILON)
+    surfel->isValid = false;
+    if (scene_.Empty())
+        return false;
+
+    // the top level is in the object's space, each instance's hierarchy and
+    // triangles in its mesh's
+    Ray sceneRay = WorldToObject(ray);
+    // precompute the inverse direction for the box tests
+    Cartesian3 invDir(1.0f / sceneRay.direction_.x, 1.0f / sceneRay.direction_.y, 
+        1.0f / sceneRay.direction_.z);
+    const std::vector<BVHNode>& nodes = scene_.topLevel.nodes;
+    // the closest hit so far, the surfel is only filled in for the last one
+    TriangleHit hit;
+    hit.t = std::numeric_limits<float>::infinity();
+    const MeshInstance* hitInstance = nullptr;
+
+    // depth first traversal of the top level with an explicit stack of node indices
+    unsigned int stack[BVH_MAX_DEPTH];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+    float tEntry;
+    while (stackSize > 0) {
+        const BVHNode& node = nodes[stack[--stackSize]];
+        // skip nodes that are missed or lie behind the closest hit so far
+        if (!node.bounds.Intersect(sceneRay, invDir, 0.0f, hit.t, tEntry))
+            continue;
+
+        if (node.IsLeaf()) {
+            for (unsigned int prim = node.first; prim < node.first + node.count; prim++) {
+                const MeshInstance& instance =
+                    scene_.instances[scene_.topLevel.primitives[prim]];
+                if (ClosestMeshHit(*instance.mesh, instance.ToMesh(sceneRay), hit))
+                    hitInstance = &instance;
+            }
+            continue;
+        }
+
+        // visit the nearer child first so the far one is more likely to be culled
+        unsigned int first = &node - &nodes[0] + 1, second = node.first;
+        float tFirst, tSecond;
+        bool hitFirst = nodes[first].bounds.Intersect(
+            sceneRay, invDir, 0.0f, hit.t, tFirst);
+        bool hitSecond = nodes[second].bounds.Intersect(
+            sceneRay, invDir, 0.0f, hit.t, tSecond);
+        if (hitFirst && hitSecond) {
+            if (tSecond < tFirst)
+                std::swap(first, second);
+            stack[stackSize++] = second;
+            stack[stackSize++] = first;
+        }
+        else if (hitFirst)
+            stack[stackSize++] = first;
+        else if (hitSecond)
+            stack[stackSize++] = second;
+    }
+    if (hitInstance == nullptr)
+        return false;
+
+    // fill in the surfel, bringing the hit back to world space for shading. The
+    // parameter t is also the distance along the world space ray since its 
+    // direction is unit length
+    const TexturedObject& mesh = *hitInstance->mesh;
+    Cartesian3 normal = mesh.triangleTable.Normal(hit.tri);
+    Cartesian3 sceneNormal = (hitInstance->normalToScene *
+        Homogeneous4(normal.x, normal.y, normal.z, 0.0f)).Vector();
+    surfel->position_ = ray.at(hit.t);
+    surfel->normal_ = (objectToWorld_ * Homogeneous4(sceneNormal.x, sceneNormal.y,
+        sceneNormal.z, 0.0f)).Vector().unit();
+    surfel->object_ = &mesh;
+    surfel->triangle_ = &mesh.faces[mesh.triangleTable.face[hit.tri]];
+    // beta and gamma weight the second and third vertices, alpha the first
+    surfel->barycentric_.alpha = 1.0f - hit.beta - hit.gamma;
+    surfel->barycentric_.beta = hit.beta;
+    surfel->barycentric_.gamma = hit.gamma;
+    surfel->distanceToEye = hit.t;
+    surfel->isValid = true;
+    // use the truthiness of the light id the surfel belongs to
+    surfel->isLight_ = surfel->triangle_->lightId; // will be 0 if not light
+    return true;
+}
+
+// closest hit of a ray in the mesh's space against the mesh's triangles,
+// replacing hit if one is nearer. Returns true if it was replaced
+bool RayTracer::ClosestMeshHit(const TexturedObject& mesh, const Ray& meshRay,
+    TriangleHit& hit) {
+    if (mesh.bvh.Empty())
+        return false;
+    Cartesian3 invDir(1.0f / meshRay.direction_.x, 1.0f / meshRay.direction_.y, 
+        1.0f / meshRay.direction_.z);
+    const std::vector<WideBVHNode>& nodes = mesh.bvh.nodes;
+    const TriangleTable& table = mesh.triangleTable;
+    bool found = false;
+
+    // depth first traversal with an explicit stack of the children still to
+    // visit, starting from the root
+    WideBVHEntry stack[WIDE_BVH_STACK_SIZE];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = WideBVHEntry{0, 0, 0.0f};
+    float tEntry[WIDE_BVH_WIDTH];
+    while (stackSize > 0) {
+        const WideBVHEntry entry = stack[--stackSize];
+        // skip children that lie behind the closest hit found since they were pushed
+        if (entry.tEntry > hit.t)
             continue;
 
-        // compute parameter t for ray intersection on plane and compute it
-        intersect = ray.at((v0 - ray.origin_).dot(normal) / rayDotNormal);
+        if (entry.count != 0) {
+            // the leaf's triangles are tested as a batch
+            if (table.ClosestHit(meshRay, entry.index, entry.count, hit))
+                found = true;
+            continue;
+        }
 
-        // compute barycentric alpha and beta, which we use to...
-        float alpha = normal.dot(v.cross(intersect - v1));
-        float beta = normal.dot(w.cross(intersect - v2));
-        // ... perform half plane test here
-        if ((alpha < 0) || (beta < 0) || (normal.dot(u.cross(intersect - v0)) < 0))
+        // test all the children's boxes at once, then push the ones hit from
+        // the farthest to the nearest so the near ones are visited first and
+        // the far ones are more likely to be culled
+        const WideBVHNode& node = nodes[entry.index];
+        unsigned int hits = WideBVH::IntersectChildren(
+            node, meshRay, invDir, 0.0f, hit.t, tEntry);
+        WideBVHEntry children[WIDE_BVH_WIDTH];
+        unsigned int childCount = 0;
+        for (unsigned int child = 0; hits != 0; child++, hits >>= 1) {
+            if (!(hits & 1))
+                continue;
+            WideBVHEntry childEntry = (node.triangleCount[child] != 0) ?
+                WideBVHEntry{node.primitiveBase + node.childOffset[child],
+                    node.triangleCount[child], tEntry[child]} :
+                WideBVHEntry{node.childBase + node.childOffset[child], 0, tEntry[child]};
+            // insertion sort, farthest first
+            unsigned int slot = childCount++;
+            for (; (slot > 0) && (children[slot - 1].tEntry < childEntry.tEntry); slot--)
+                children[slot] = children[slot - 1];
+            children[slot] = childEntry;
+        }
+        for (unsigned int child = 0; child < childCount; child++)
+            stack[stackSize++] = children[child];
+    }
+    return found;
+}
+
+// any hit query for shadow rays, returns true on the first triangle found 
+// between tMin and tMax without looking for the closest one
+bool RayTracer::Occluded(const Ray& ray, const float& tMin, const float& tMax) {
+    if (scene_.Empty() || (tMax <= tMin))
+        return false;
+
+    // t is the same in every space, so the segment bounds carry over
+    Ray sceneRay = WorldToObject(ray);
+    Cartesian3 invDir(1.0f / sceneRay.direction_.x, 1.0f / sceneRay.direction_.y, 
+        1.0f / sceneRay.direction_.z);
+    const std::vector<BVHNode>& nodes = scene_.topLevel.nodes;
+
+    // same traversal of the top level, but order does not matter here
+    unsigned int stack[BVH_MAX_DEPTH];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+    float tEntry;
+    while (stackSize > 0) {
+        unsigned int nodeIndex = stack[--stackSize];
+        const BVHNode& node = nodes[nodeIndex];
+        if (!node.bounds.Intersect(sceneRay, invDir, tMin, tMax, tEntry))
             continue;
 
-        // if we got this far, we found a valid triangle. we create a new surfel
-        // if the distance to the eye is smaller than current distance
-        float d = (intersect - ray.origin_).length();
-        if (d < surfel->distanceToEye) {
-            // replace previous surfel with a new one that is closer
-            surfel->position_ = intersect;
-            surfel->normal_ = normal.unit(); // normal computed for us
-            surfel->triangle_ = object_->faces[tri];
-            // we know alpha and beta, and by extension, gamma from the half-plane test
-            float normalDotNormal = 1.0 / normal.dot(normal) ;
-            surfel->barycentric_.alpha =  alpha * normalDotNormal;
-            surfel->barycentric_.beta = beta * normalDotNormal;
-            surfel->barycentric_.gamma = 1.0 - surfel->barycentric_.alpha - surfel->barycentric_.beta;
-            // update distance to eye
-            surfel->distanceToEye = d;
-            surfel->isValid = true;
-            // use the truthiness of the light id the surfel belongs to
-            surfel->isLight_ = surfel->triangle_->lightId; // will be 0 if not light
+        if (node.IsLeaf()) {
+            for (unsigned int prim = node.first; prim < node.first + node.count; prim++) {
+                const MeshInstance& instance =
+                    scene_.instances[scene_.topLevel.primitives[prim]];
+                if (MeshOccluded(*instance.mesh, instance.ToMesh(sceneRay), tMin, tMax))
+                    return true;
+            }
+            continue;
+        }
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = nodeIndex + 1;
+    }
+    return false;
+}
+
+// whether any of the mesh's triangles blocks a ray in its space within [tMin, tMax]
+bool RayTracer::MeshOccluded(const TexturedObject& mesh, const Ray& meshRay,
+    float tMin, float tMax) {
+    if (mesh.bvh.Empty())
+        return false;
+    Cartesian3 invDir(1.0f / meshRay.direction_.x, 1.0f / meshRay.direction_.y, 
+        1.0f / meshRay.direction_.z);
+    const std::vector<WideBVHNode>& nodes = mesh.bvh.nodes;
+    const TriangleTable& table = mesh.triangleTable;
+
+    // same traversal as the closest hit query, but order does not matter here
+    // so leaves are tested as soon as their box is hit
+    unsigned int stack[WIDE_BVH_STACK_SIZE];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+    float tEntry[WIDE_BVH_WIDTH];
+    while (stackSize > 0) {
+        const WideBVHNode& node = nodes[stack[--stackSize]];
+        unsigned int hits = WideBVH::IntersectChildren(
+            node, meshRay, invDir, tMin, tMax, tEntry);
+        for (unsigned int child = 0; hits != 0; child++, hits >>= 1) {
+            if (!(hits & 1))
+                continue;
+            if (node.triangleCount[child] == 0)
+                stack[stackSize++] = node.childBase + node.childOffset[child];
+            else if (table.AnyHit(meshRay, node.primitiveBase + node.childOffset[child],
+                node.triangleCount[child], tMin, tMax))
+                return true;
         }
     }
-    return surfel->isValid;
+    return false;
 }
 
 // method for computing direct light
 RGBRadiance RayTracer::DirectLight(
-    const Surfel& surfel, const Cartesian3& outDir, const Light& light) {
+    const Surfel& surfel, const Cartesian3& outDir, const Light& light, 
+    RandomGenerator& rng, int stratum) {
     // incoming light direction (from light to surfel) and position
     Cartesian3 lightPos;
         
-    if (light.isAreaLight) 
-        lightPos = GetRandomAreaLightPoint(light);
+    // the samples of a pixel share its first hit, so spreading them over the 
+    // light there softens shadow noise, deeper bounces sample it at random
+    if (light.isAreaLight && (stratum >= 0))
+        lightPos = GetStratifiedAreaLightPoint(light, stratum, rng);
+    else if (light.isAreaLight) 
+        lightPos = GetRandomAreaLightPoint(light, rng);
     else
         lightPos = light.position;
 
-    Cartesian3 inDir = (lightPos - surfel.position_).unit();
-    // compute shadow rays
-    Surfel shadowSurfel;
-    // check if surfel are on the same triangle, if not then light is blocked
-    if (ClosestTriangleIntersect(Ray(lightPos, -inDir), &shadowSurfel)
-         && shadowSurfel.triangle_->id != surfel.triangle_->id) {
-            return RGBRadiance(); // no light
-    }
+    Cartesian3 toLight = lightPos - surfel.position_;
+    float lightDistance = toLight.length();
+    Cartesian3 inDir = toLight / lightDistance;
+    // cast a shadow ray towards the light, the epsilons keep the surfel's own 
+    // triangle and the light's triangle out of the test
+    if (Occluded(Ray(surfel.position_, inDir), EPSILON, lightDistance - EPSILON))
+        return RGBRadiance(); // no light
 
     // check that surfel is on area light, if so return the light
     // compute attenuation
@@ -334,67 +618,62 @@ RGBRadiance RayTracer::DirectLight(
     return surfel.BRDF(outDir, inDir) * light.intensity / distsqr;
 }
 
-// method for computing indirect light
-RGBRadiance RayTracer::IndirectLight(
-    const Surfel& surfel, const Cartesian3& outDir, const RGBRadiance& combinedAlbedo, int& depth) {
+// samples the direction a path continues in from a surfel and the albedo the
+// light coming back along it is weighted by, returns false if the path ends
+bool RayTracer::SampleIndirect(
+    const Surfel& surfel, const Cartesian3& outDir, RandomGenerator& rng,
+    Cartesian3& inDir, RGBRadiance& albedo) {
 
-    // probabislistic extinction coefficient
-    if (RandomRange(0.0f, 1.0f) < surfel.extinction_)
-        return RGBRadiance();
-
-    // declare direction and albedo
-    Cartesian3 indirectDir;
-    RGBRadiance albedo;
+    // probabislistic extinction coefficient, the material absorbs the path
+    if (RandomRange(rng, 0.0f, 1.0f) < surfel.extinction_)
+        return false;
 
     // uniform distribution so if impulse is at 0.6, then there is a 60% chance to
     // go through impulse code path
-    if (RandomRange(0.0f, 1.0f) < surfel.impulse_) {
+    if (RandomRange(rng, 0.0f, 1.0f) < surfel.impulse_) {
         // 
-        //indirectDir = 2.0f * surfel.normal_ - outDir; // perfect reflection
-        indirectDir = Reflect(-outDir, surfel.normal_);
+        //inDir = 2.0f * surfel.normal_ - outDir; // perfect reflection
+        inDir = Reflect(-outDir, surfel.normal_);
         albedo = surfel.impulseAlbedo_;
     }
     else {
         // compute indirect radiance at the pixel
-        indirectDir = MonteCarlo3D(surfel.normal_); // random vector on hemisphere
-        albedo = surfel.BRDF(outDir, indirectDir);
+        float pdf;
+        inDir = MonteCarlo3D(surfel.normal_, rng, pdf); // cosine weighted vector
+        // directions grazing the surface carry no lambertian light
+        if (pdf < EPSILON)
+            return false;
+        // the old sampler was uniform over the hemisphere and never divided by
+        // its density of 1 / 2 PI, so weighting by 1 / (2 PI pdf) converges to 
+        // the same image, just with less noise
+        albedo = surfel.BRDF(outDir, inDir) / (2.0f * PI * pdf);
     }
-    
-    // compute lighting at point
-    RGBRadiance inLight = PathTrace(Ray(surfel.position_, indirectDir), combinedAlbedo * albedo, ++depth);
-    // return the albedo scaled by incoming light
-    return inLight * albedo;
+    return true;
 }
 
 
-// Monte Carlo integration, always returns a unit direction vector pointing in normal direction
-Cartesian3 RayTracer::MonteCarlo3D(const Cartesian3& normal) {
-    Cartesian3 direction;
-    float u, v, length;
-    // loop till we find a valid direction
-    while (true) {
-        /*
-        u = RandomRange(0.0f, 1.0f);
-        v = RandomRange(0.0f, 1.0f);
-        // compute direction on hemisphere
-        direction.x = std::cos(2.0f * PI * u);
-        direction.y = v;
-        direction.z = std::sin(2.0f * PI * u);
-        */
-        direction.x = RandomRange(0.0f, 2.0f) - 1.0f;
-        direction.y = RandomRange(0.0f, 2.0f) - 1.0f;
-        direction.z = RandomRange(0.0f, 2.0f) - 1.0f;
-        // compute and compare length
-        length = direction.length();
-        if ((length < 0.1f) || (length > 1.0f))
-            continue;
-        // loop again if direction points away from the normal
-        if (direction.dot(normal) < EPSILON)
-            continue;
-        return direction / length;
-    }
-    // keep compiler happy :-)
-    return direction;
+// Monte Carlo integration, returns a unit direction vector on the hemisphere 
+// around the normal, drawn with a density proportional to the cosine to the 
+// normal, and that density in pdf
+Cartesian3 RayTracer::MonteCarlo3D(const Cartesian3& normal, RandomGenerator& rng, 
+    float& pdf) {
+    // orthonormal basis around the normal (Duff et al. 2017), no branches and
+    // stable for every unit normal
+    float sign = std::copysign(1.0f, normal.z);
+    float a = -1.0f / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    Cartesian3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    Cartesian3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+    // uniform point on the unit disc projected up onto the hemisphere
+    float u = RandomRange(rng, 0.0f, 1.0f);
+    float phi = 2.0f * PI * RandomRange(rng, 0.0f, 1.0f);
+    float radius = std::sqrt(u);
+    float cosTheta = std::sqrt(std::max(0.0f, 1.0f - u));
+
+    pdf = cosTheta / PI;
+    return radius * std::cos(phi) * tangent + radius * std::sin(phi) * bitangent 
+        + cosTheta * normal;
 }
 
 Cartesian3 RayTracer::Reflect(const Cartesian3& dir, const Cartesian3& normal) {
@@ -402,31 +681,37 @@ Cartesian3 RayTracer::Reflect(const Cartesian3& dir, const Cartesian3& normal) {
     return dir - 2.0f * (dir.dot(normal)) * normal;
 }
 
-// random number generator in range [lower, upper]
-float RayTracer::RandomRange(float lower, float upper) {
-    // initialise the generator with the seed
-    std::uniform_real_distribution<float> distribution(lower, upper);
-    return distribution(generator_);
+// random number in range [lower, upper)
+float RayTracer::RandomRange(RandomGenerator& rng, float lower, float upper) {
+    return lower + (upper - lower) * rng.NextFloat();
 }
 
-// returns valid barycentric coordinates for any triangle
-Cartesian3 RayTracer::GetRandomAreaLightPoint(const Light& light) {
-    float alpha, beta, sum;
-    // loop till we get valid barycentric coordinates
-    while (true) {
-        alpha = RandomRange(0.0f, 1.0f);
-        beta = RandomRange(0.0f, 1.0f);
-        sum = alpha + beta;
-        // loop again if barycentric coordinates are invalid
-        if ((sum >= 0.0f) && (sum <= 1.0f))
-            break;
-    }
-    // compute the point on the triangle from light's vertices
-    Cartesian3 point = 
-        object_->vertices[light.triangle->vertices[0]] * alpha +
-        object_->vertices[light.triangle->vertices[1]] * beta + 
-        object_->vertices[light.triangle->vertices[2]] * (1.0f - alpha - beta);
-    return point;        
+// maps two numbers in [0,1) to a uniformly distributed point on the light
+Cartesian3 RayTracer::AreaLightPoint(const Light& light, float u1, float u2) {
+    // square root warp of the unit square onto the triangle, every pair of 
+    // numbers gives a valid point so nothing is rejected
+    float su = std::sqrt(u1);
+    Cartesian3 point = light.vertex0 + 
+        light.edge1 * (su * (1.0f - u2)) + light.edge2 * (su * u2);
+    // the vertices are in object space, the shading is done in world space
+    return objectToWorld_ * point;
+}
+
+// returns a uniformly distributed point on the light
+Cartesian3 RayTracer::GetRandomAreaLightPoint(const Light& light, RandomGenerator& rng) {
+    float u1 = rng.NextFloat();
+    return AreaLightPoint(light, u1, rng.NextFloat());
+}
+
+// returns a point jittered within the stratum's cell of a square grid over the
+// unit square, samples past the largest grid that fits are left at random
+Cartesian3 RayTracer::GetStratifiedAreaLightPoint(const Light& light, 
+    unsigned int stratum, RandomGenerator& rng) {
+    if (stratum >= lightStrata_ * lightStrata_)
+        return GetRandomAreaLightPoint(light, rng);
+    float u1 = (stratum % lightStrata_ + rng.NextFloat()) / lightStrata_;
+    float u2 = (stratum / lightStrata_ + rng.NextFloat()) / lightStrata_;
+    return AreaLightPoint(light, u1, u2);
 }
 
 
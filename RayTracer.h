@@ -2,59 +2,127 @@
 #define RAYTRACER_H
 
 
-#include <random>
-
 #include "RenderParameters.h"
 #include "RGBAImage.h"
+#include "Scene.h"
 #include "Surfel.h"
 #include "TexturedObject.h"
+#include "ThreadPool.h"
+#include "TileScheduler.h"
 #include "Utils.h"
 
+// steps of the table taking averaged radiance in [0, 1) to a display byte, one
+// more entry holds saturated radiance
+constexpr unsigned int GAMMA_TABLE_SIZE = 4096;
+// adaptive sampling gives no pixel more than this many times the requested samples
+constexpr unsigned int ADAPTIVE_MAX_FACTOR = 4;
+
 // the ray tracer class, ray traces an image 
 class RayTracer {   
     public:
+        // nThreads is the number of render threads, 0 uses every core
         RayTracer(RGBAImage* frameBuffer, RenderParameters* renderParameters, 
-        TexturedObject* object)
+        TexturedObject* object, unsigned int nThreads = 0)
             : frameBuffer_ (frameBuffer), parameters_(renderParameters), 
-            object_(object) {}
-        ~RayTracer() {}
+            object_(object), scene_(object), samplesTaken_(0), pixelBuffer_(nullptr),
+            threadPool_(nThreads) { BuildGammaTable(); }
+        ~RayTracer() { EndRender(); }
 
         // raytrace the image
         void RayTraceImage();
             //RGBAImage* image, TexturedObject* theObject, RenderParameters* params);
 
+        // progressive rendering: each pass adds one sample per pixel to a
+        // buffer kept between passes and writes the running average to the
+        // frame buffer. The frame buffer must keep its size until the end.
+        // Area lights are sampled at random rather than on the full render's
+        // grid of strata, so the passes converge to the same image but do not
+        // give the same pixels
+        void BeginProgressive();
+        // returns false once no pixel needs more samples
+        bool ProgressivePass();
+        void EndProgressive();
+
+        // passes of samples since the render began
+        unsigned int SamplesTaken() const { return samplesTaken_; }
+
     private: 
-        // a sub function that ray traces certain sections of the image
-        void RayTracePixelsThread(
-            const long& begin, const long& rows, const Cartesian3& eyePos);
+        // set up the transforms and an empty radiance buffer for a render
+        void BeginRender();
+        // free the radiance buffer of a render
+        void EndRender();
+
+        // add count samples to every pixel of the buffer that needs them,
+        // returns the number of samples taken
+        unsigned long TraceSamples(unsigned int count);
+
+        // spread the render's samples over the pixels whose estimated error
+        // is above the threshold
+        void TraceAdaptive();
+
+        // whether a pixel takes part in the next round of samples
+        bool NeedsSamples(const Pixel& pixel) const;
 
-        // path trace a single ray
-        RGBRadiance PathTrace(const Ray& ray, const RGBRadiance& combinedAlbedo, int& depth);
+        // write the average of the samples so far to the frame buffer
+        void Resolve();
+
+        // a sub function that adds count samples to the pixels of a tile of
+        // the image that need them, returns the number of samples taken
+        unsigned long RayTraceTile(const Tile& tile, unsigned int count);
+
+        // fill the table that replaces pow when converting radiance to bytes
+        void BuildGammaTable();
+
+        // average the samples of a band of rows and write them to the frame buffer
+        void ResolveRows(long rowBegin, long rowEnd);
+
+        // path trace from a pixel's first hit, stratum is the pixel sample's
+        // index when area lights are stratified
+        RGBRadiance PathTrace(const Surfel& firstHit, const Cartesian3& firstOutDir,
+            RandomGenerator& rng, int stratum);
 
         // get the transformations set through UI
-        Matrix4 GetTransform(const bool& inverse, const float& scale);
+        Matrix4 GetTransform(const float& scale);
+
+        // take a world space ray into the object's space
+        Ray WorldToObject(const Ray& ray) const;
             
         // return a pointer to a surfel at intersection of ray with object
         bool ClosestTriangleIntersect(const Ray& ray, Surfel* surfel);
 
+        // returns true as soon as any triangle blocks the ray within [tMin, tMax]
+        bool Occluded(const Ray& ray, const float& tMin, const float& tMax);
+
+        // the same two queries against a single mesh, with a ray in its space
+        bool ClosestMeshHit(const TexturedObject& mesh, const Ray& meshRay,
+            TriangleHit& hit);
+        bool MeshOccluded(const TexturedObject& mesh, const Ray& meshRay,
+            float tMin, float tMax);
+
         // lighting methods
         RGBRadiance DirectLight(
-            const Surfel& surfel, const Cartesian3& outDir, const Light& light);
-        RGBRadiance IndirectLight(
-            const Surfel& surfel, const Cartesian3& outDir, 
-            const RGBRadiance& combinedAlbedo, int& depth);
+            const Surfel& surfel, const Cartesian3& outDir, const Light& light,
+            RandomGenerator& rng, int stratum);
+        bool SampleIndirect(
+            const Surfel& surfel, const Cartesian3& outDir, RandomGenerator& rng,
+            Cartesian3& inDir, RGBRadiance& albedo);
         
-        // Monte Carlo integration, returns a direction vector
-        Cartesian3 MonteCarlo3D(const Cartesian3& normal);
+        // Monte Carlo integration, returns a cosine weighted direction vector 
+        // and its probability density
+        Cartesian3 MonteCarlo3D(const Cartesian3& normal, RandomGenerator& rng, 
+            float& pdf);
         
         // reflects a direction vector around a given normal
         Cartesian3 Reflect(const Cartesian3& dir, const Cartesian3& normal);
 
         // return a random number between a given range
-        float RandomRange(float lower, float upper);
+        float RandomRange(RandomGenerator& rng, float lower, float upper);
 
-        // gives a random barycentric coordinate for a given triangle
-        Cartesian3 GetRandomAreaLightPoint(const Light& light);
+        // area light sampling, uniform over the light's triangle in world space
+        Cartesian3 AreaLightPoint(const Light& light, float u1, float u2);
+        Cartesian3 GetRandomAreaLightPoint(const Light& light, RandomGenerator& rng);
+        Cartesian3 GetStratifiedAreaLightPoint(const Light& light, 
+            unsigned int stratum, RandomGenerator& rng);
 
     public:
         // the image to write to
@@ -63,13 +131,28 @@ class RayTracer {
         RenderParameters* parameters_;
         // the objetc in the scene
         TexturedObject* object_;
+        // the meshes traced, the object and any instances placed around it
+        Scene scene_;
         // the number of samples for indirect light integration
         float nSamples_;
+        // rounds of samples since the render began, the most any pixel has
+        unsigned int samplesTaken_;
+        // bounds on the samples of a pixel under adaptive sampling, the
+        // minimum is also the size of a round of samples
+        unsigned int minSamples_, maxSamples_;
+        // position of the eye for this render
+        Cartesian3 eyePos_;
+        // side of the grid area light samples are stratified over
+        unsigned int lightStrata_;
         // a radiance buffer and its dimensions (from RGBAImage)
         Pixel* pixelBuffer_;
         long height_, width_;
-        // randome number generator
-        std::default_random_engine generator_;
+        // transforms between the object's space and world space for this render
+        Matrix4 objectToWorld_, worldToObject_;
+        // worker threads kept alive between renders
+        ThreadPool threadPool_;
+        // display byte for each step of averaged radiance
+        unsigned char gammaTable_[GAMMA_TABLE_SIZE + 1];
 };
 
 
@@ -0,0 +1,276 @@
+// c++ default libraries
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "RayTracer.h"
+#include "RenderParameters.h"
+#include "RGBAImage.h"
+#include "SceneCache.h"
+#include "TexturedObject.h"
+
+// print the flags the batch renderer understands
+static void PrintUsage(const char* program) {
+    std::cout << "Usage: " << program << " geometry [options]\n"
+        << "  --output file        image to write, binary ppm (render.ppm)\n"
+        << "  --ascii              write an ascii ppm instead\n"
+        << "  --texture file       ppm texture of the object\n"
+        << "  --cache file         binary scene cache, read if it is up to date\n"
+        << "                       and written from the object otherwise\n"
+        << "  --width n            image width in pixels (512)\n"
+        << "  --height n           image height in pixels (512)\n"
+        << "  --samples n          samples per pixel (1)\n"
+        << "  --adaptive t         spend the samples on the pixels whose error on\n"
+        << "                       the 0 to 1 display scale is above t (0.01)\n"
+        << "  --seed n             seed of the random numbers (0)\n"
+        << "  --threads n          render threads, 0 uses every core (0)\n"
+        << "  --bvh mode           how the hierarchy is built: sah, linear for a\n"
+        << "                       fast rebuild, treelets for a linear build\n"
+        << "                       with its treelets reorganised, or spatial to\n"
+        << "                       also split long thin triangles (sah)\n"
+        << "  --max-depth n        surfaces a path can bounce off (16)\n"
+        << "  --roulette-depth n   depth russian roulette starts at (3)\n"
+        << "  --eye x y z          position of the eye (0 0 3)\n"
+        << "  --rotate x y z deg   rotate the object around an axis\n"
+        << "  --translate x y      translate the object\n"
+        << "  --zoom s             scale the object\n"
+        << "  --centre             centre the object on its centre of gravity\n"
+        << "  --scale              scale the object to a unit sphere\n"
+        << "  --instance file x y z s\n"
+        << "                       place a copy of a mesh in the object's space,\n"
+        << "                       translated and scaled. Copies of the same file\n"
+        << "                       share its geometry and hierarchy" << std::endl;
+}
+
+// a mesh to place in the scene, read once however many times it is placed
+struct InstanceSpec {
+    std::string path;
+    Cartesian3 translation;
+    float scale;
+};
+
+// parse the argument at index as a number, returns false if it is missing or
+// not entirely a number
+static bool ParseFloat(int argc, char** argv, int index, float& value) {
+    if (index >= argc)
+        return false;
+    char* end;
+    value = std::strtof(argv[index], &end);
+    return (end != argv[index]) && (*end == '\0');
+}
+
+static bool ParseUnsigned(int argc, char** argv, int index, unsigned int& value) {
+    if ((index >= argc) || (argv[index][0] == '-'))
+        return false;
+    char* end;
+    value = std::strtoul(argv[index], &end, 10);
+    return (end != argv[index]) && (*end == '\0');
+}
+
+// renders an object to a file without a window, for servers with no display
+int main(int argc, char** argv) {
+    if ((argc < 2) || (std::strcmp(argv[1], "--help") == 0)) {
+        PrintUsage(argv[0]);
+        return argc < 2 ? 1 : 0;
+    }
+
+    RenderParameters renderParameters;
+    std::string outputPath = "render.ppm";
+    std::string texturePath;
+    std::string cachePath;
+    unsigned int width = 512, height = 512, nThreads = 0;
+    std::vector<InstanceSpec> instanceSpecs;
+    bool binary = true;
+
+    // go through the flags, each one checks it got all of its values
+    bool valid = true;
+    for (int arg = 2; valid && (arg < argc); arg++) {
+        std::string flag = argv[arg];
+        if ((flag == "--output") && (arg + 1 < argc))
+            outputPath = argv[++arg];
+        else if ((flag == "--texture") && (arg + 1 < argc))
+            texturePath = argv[++arg];
+        else if ((flag == "--cache") && (arg + 1 < argc))
+            cachePath = argv[++arg];
+        else if (flag == "--ascii")
+            binary = false;
+        else if (flag == "--width")
+            valid = ParseUnsigned(argc, argv, ++arg, width) && (width > 0);
+        else if (flag == "--height")
+            valid = ParseUnsigned(argc, argv, ++arg, height) && (height > 0);
+        else if (flag == "--samples") {
+            unsigned int samples;
+            valid = ParseUnsigned(argc, argv, ++arg, samples) && (samples > 0);
+            renderParameters.samples_ = samples;
+        }
+        else if (flag == "--adaptive") {
+            renderParameters.adaptiveSampling = true;
+            valid = ParseFloat(argc, argv, ++arg, renderParameters.adaptiveThreshold) &&
+                (renderParameters.adaptiveThreshold > 0.0f);
+        }
+        else if (flag == "--seed")
+            valid = ParseUnsigned(argc, argv, ++arg, renderParameters.seed);
+        else if (flag == "--threads")
+            valid = ParseUnsigned(argc, argv, ++arg, nThreads);
+        else if ((flag == "--bvh") && (arg + 1 < argc)) {
+            std::string mode = argv[++arg];
+            if (mode == "sah")
+                renderParameters.bvhBuildMode = BVH_BUILD_SAH;
+            else if (mode == "linear")
+                renderParameters.bvhBuildMode = BVH_BUILD_LINEAR;
+            else if (mode == "treelets")
+                renderParameters.bvhBuildMode = BVH_BUILD_LINEAR_TREELETS;
+            else if (mode == "spatial")
+                renderParameters.bvhBuildMode = BVH_BUILD_SPATIAL;
+            else
+                valid = false;
+        }
+        else if (flag == "--max-depth")
+            valid = ParseUnsigned(argc, argv, ++arg, renderParameters.maxDepth);
+        else if (flag == "--roulette-depth")
+            valid = ParseUnsigned(argc, argv, ++arg, renderParameters.rouletteDepth);
+        else if (flag == "--eye") {
+            Cartesian3& eye = renderParameters.eyePosition;
+            valid = ParseFloat(argc, argv, arg + 1, eye.x) &&
+                ParseFloat(argc, argv, arg + 2, eye.y) &&
+                ParseFloat(argc, argv, arg + 3, eye.z);
+            arg += 3;
+        }
+        else if (flag == "--rotate") {
+            Cartesian3 axis;
+            float degrees;
+            valid = ParseFloat(argc, argv, arg + 1, axis.x) &&
+                ParseFloat(argc, argv, arg + 2, axis.y) &&
+                ParseFloat(argc, argv, arg + 3, axis.z) &&
+                ParseFloat(argc, argv, arg + 4, degrees) && (axis.length() > 0.0f);
+            if (valid)
+                renderParameters.rotationMatrix.SetRotation(axis, degrees * PI / 180.0f);
+            arg += 4;
+        }
+        else if (flag == "--translate") {
+            valid = ParseFloat(argc, argv, arg + 1, renderParameters.xTranslate) &&
+                ParseFloat(argc, argv, arg + 2, renderParameters.yTranslate);
+            arg += 2;
+        }
+        else if (flag == "--zoom")
+            valid = ParseFloat(argc, argv, ++arg, renderParameters.zoomScale) &&
+                (renderParameters.zoomScale > 0.0f);
+        else if (flag == "--centre")
+            renderParameters.centreObject = true;
+        else if (flag == "--scale")
+            renderParameters.scaleObject = true;
+        else if ((flag == "--instance") && (arg + 1 < argc)) {
+            InstanceSpec spec;
+            spec.path = argv[arg + 1];
+            valid = ParseFloat(argc, argv, arg + 2, spec.translation.x) &&
+                ParseFloat(argc, argv, arg + 3, spec.translation.y) &&
+                ParseFloat(argc, argv, arg + 4, spec.translation.z) &&
+                ParseFloat(argc, argv, arg + 5, spec.scale) && (spec.scale > 0.0f);
+            instanceSpecs.push_back(spec);
+            arg += 5;
+        }
+        else
+            valid = false;
+
+        if (!valid)
+            std::cerr << "Bad or incomplete flag " << flag << std::endl;
+    }
+    if (!valid) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // open the texture file, it is only used by the preview so an empty one
+    // will do. The geometry file is mapped by the reader
+    std::ifstream textureFile;
+    std::istringstream noTexture("");
+    if (!texturePath.empty())
+        textureFile.open(texturePath, std::ios::binary);
+    std::istream& textureStream = texturePath.empty() ?
+        static_cast<std::istream&>(noTexture) : textureFile;
+    if (!texturePath.empty() && !textureFile.good()) {
+        std::cerr << "Could not open texture " << texturePath << std::endl;
+        return 1;
+    }
+
+    // read the object, which also builds its acceleration structure, unless
+    // the cache already holds both
+    auto start = std::chrono::high_resolution_clock::now();
+    TexturedObject texturedObject;
+    texturedObject.bvhBuildMode = renderParameters.bvhBuildMode;
+    if (!cachePath.empty() &&
+        LoadSceneCache(texturedObject, argv[1], cachePath.c_str()))
+        std::cout << "Read scene cache " << cachePath << std::endl;
+    else {
+        if (!texturedObject.ReadObjectFile(argv[1], textureStream)) {
+            std::cerr << "Read failed for object " << argv[1] << std::endl;
+            return 1;
+        }
+        if (!cachePath.empty()) {
+            if (SaveSceneCache(texturedObject, argv[1], cachePath.c_str()))
+                std::cout << "Wrote scene cache " << cachePath << std::endl;
+            else
+                std::cerr << "Could not write scene cache " << cachePath << std::endl;
+        }
+    }
+    auto loaded = std::chrono::high_resolution_clock::now();
+    std::cout << "Load took: " <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(loaded - start).count()
+        << "ms." << std::endl;
+    std::cout << "Triangle tests: " << TriangleTable::KernelName() << std::endl;
+
+    // render into an image of the requested size, the ray tracer reports the
+    // time the render itself took
+    RGBAImage frameBuffer;
+    if (!frameBuffer.Resize(width, height)) {
+        std::cerr << "Could not create a " << width << "x" << height << " image"
+            << std::endl;
+        return 1;
+    }
+    RayTracer rayTracer(&frameBuffer, &renderParameters, &texturedObject, nThreads);
+
+    // read each instanced mesh once and place every copy of it, they are
+    // plain geometry without textures
+    std::map<std::string, std::unique_ptr<TexturedObject>> meshes;
+    for (const InstanceSpec& spec : instanceSpecs) {
+        std::unique_ptr<TexturedObject>& mesh = meshes[spec.path];
+        if (!mesh) {
+            mesh.reset(new TexturedObject());
+            mesh->bvhBuildMode = renderParameters.bvhBuildMode;
+            std::istringstream noMeshTexture("");
+            if (!mesh->ReadObjectFile(spec.path.c_str(), noMeshTexture)) {
+                std::cerr << "Read failed for instance " << spec.path << std::endl;
+                return 1;
+            }
+        }
+        Matrix4 translation, scale;
+        translation.SetTranslation(spec.translation);
+        scale.SetScale(spec.scale, spec.scale, spec.scale);
+        rayTracer.scene_.AddInstance(mesh.get(), translation * scale);
+    }
+    if (!instanceSpecs.empty())
+        std::cout << "Placed " << instanceSpecs.size() << " instances of "
+            << meshes.size() << " meshes" << std::endl;
+    rayTracer.RayTraceImage();
+
+    std::ofstream outputFile(outputPath,
+        binary ? std::ios::out | std::ios::binary : std::ios::out);
+    if (!outputFile.good()) {
+        std::cerr << "Could not write " << outputPath << std::endl;
+        return 1;
+    }
+    frameBuffer.WritePPM(outputFile, binary);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Total took: " <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+        << "ms." << std::endl;
+    return 0;
+}
@@ -0,0 +1,52 @@
+######################################################################
+# Command line batch renderer, builds the ray tracer without Qt or OpenGL
+######################################################################
+
+QT -= core gui
+CONFIG -= qt
+CONFIG += console c++17 thread
+TEMPLATE = app
+TARGET = RaytraceBatch
+INCLUDEPATH += .
+
+# leaves the OpenGL preview code out of TexturedObject
+DEFINES += HEADLESS
+
+# Input
+HEADERS += BVH.h \
+           Cartesian3.h \
+           Homogeneous4.h \
+           Matrix4.h \
+           ObjReader.h \
+           Quaternion.h \
+           RayTracer.h \
+           RenderParameters.h \
+           RGBAImage.h \
+           RGBAValue.h \
+           Scene.h \
+           SceneCache.h \
+           Surfel.h \
+           TexturedObject.h \
+           ThreadPool.h \
+           TileScheduler.h \
+           TriangleTable.h \
+           Utils.h \
+           WideBVH.h
+SOURCES += BVH.cpp \
+           Cartesian3.cpp \
+           Homogeneous4.cpp \
+           Matrix4.cpp \
+           ObjReader.cpp \
+           Quaternion.cpp \
+           RaytraceBatch.cpp \
+           RayTracer.cpp \
+           RGBAImage.cpp \
+           RGBAValue.cpp \
+           Scene.cpp \
+           SceneCache.cpp \
+           Surfel.cpp \
+           TexturedObject.cpp \
+           ThreadPool.cpp \
+           TileScheduler.cpp \
+           TriangleTable.cpp \
+           WideBVH.cpp
@@ -16,6 +16,7 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <math.h>
+#include <iostream>
 
 // include the header file
 #include "RaytraceRenderWidget.h"
@@ -41,6 +42,10 @@ RaytraceRenderWidget::RaytraceRenderWidget
     // create a raytracer object, doesn't need to be dynamically created 
     rayTracer(&frameBuffer, newRenderParameters, newTexturedObject)
     { // constructor
+    // a zero interval timer runs a pass each time the event loop has nothing 
+    // else to do, so the window stays responsive between passes
+    passTimer.setInterval(0);
+    connect(&passTimer, SIGNAL(timeout()), this, SLOT(RaytracePass()));
     } // constructor    
 
 // destructor
@@ -60,6 +65,8 @@ void RaytraceRenderWidget::initializeGL()
 // called every time the widget is resized
 void RaytraceRenderWidget::resizeGL(int w, int h)
     { // RaytraceRenderWidget::resizeGL()
+    // a progressive render cannot go on in an image of another size
+    StopRaytrace();
     // resize the render image
     frameBuffer.Resize(w, h);
     } // RaytraceRenderWidget::resizeGL()
@@ -78,11 +85,57 @@ void RaytraceRenderWidget::paintGL()
     // routine that generates the image
 void RaytraceRenderWidget::Raytrace()
     { // RaytraceRenderWidget::Raytrace()
+    // start again from scratch if a render is still refining
+    StopRaytrace();
 
-	// This is where you will invoke your raytracing
-    rayTracer.RayTraceImage();//&frameBuffer, texturedObject, renderParameters);
-    
+    // rebuild the acceleration structure if another build mode was chosen
+    if (texturedObject->bvhBuildMode != renderParameters->bvhBuildMode)
+        { // rebuild
+        texturedObject->bvhBuildMode = renderParameters->bvhBuildMode;
+        texturedObject->BuildAccelerationStructure();
+        } // rebuild
+
+    if (renderParameters->progressiveRendering)
+        { // progressive
+        // the passes run from the timer, repainting as they go
+        rayTracer.BeginProgressive();
+        renderClock.start();
+        passTimer.start();
+        } // progressive
+    else
+        { // single render
+	    // This is where you will invoke your raytracing
+        rayTracer.RayTraceImage();//&frameBuffer, texturedObject, renderParameters);
+        } // single render
     } // RaytraceRenderWidget::Raytrace()
+
+// stop a progressive render, keeping the image it has reached
+void RaytraceRenderWidget::StopRaytrace()
+    { // RaytraceRenderWidget::StopRaytrace()
+    if (!passTimer.isActive())
+        return;
+    passTimer.stop();
+    rayTracer.EndProgressive();
+    } // RaytraceRenderWidget::StopRaytrace()
+
+// add a pass to the progressive render and show the running average
+void RaytraceRenderWidget::RaytracePass()
+    { // RaytraceRenderWidget::RaytracePass()
+    bool refining = rayTracer.ProgressivePass();
+    unsigned int samples = rayTracer.SamplesTaken();
+    update();
+
+    // refine until the target samples are taken, every pixel is below the 
+    // adaptive sampling threshold or the time budget runs out
+    bool outOfTime = (renderParameters->renderTimeBudget > 0.0f) &&
+        (renderClock.elapsed() >= 1000.0f * renderParameters->renderTimeBudget);
+    if (!refining || (samples >= renderParameters->samples_) || outOfTime)
+        { // finished
+        std::cout << "Progressive render took: " << renderClock.elapsed() << "ms for "
+            << samples << " samples." << std::endl;
+        StopRaytrace();
+        } // finished
+    } // RaytraceRenderWidget::RaytracePass()
     
 // mouse-handling
 void RaytraceRenderWidget::mousePressEvent(QMouseEvent *event)
@@ -22,6 +22,8 @@
 // include the relevant QT headers
 #include <QOpenGLWidget>
 #include <QMouseEvent>
+#include <QTimer>
+#include <QElapsedTimer>
 
 // and include all of our own headers that we need
 #include "TexturedObject.h"
@@ -45,6 +47,12 @@ class RaytraceRenderWidget : public QOpenGLWidget
 	// raytracer object which computes the ray traced image
 	RayTracer rayTracer;
 
+	// fires whenever the event loop is idle while a progressive render runs
+	QTimer passTimer;
+
+	// time since the progressive render began
+	QElapsedTimer renderClock;
+
 	public:
 	// constructor
 	RaytraceRenderWidget
@@ -63,6 +71,12 @@ class RaytraceRenderWidget : public QOpenGLWidget
     // routine that generates the image
     void Raytrace();
 
+	// stop a progressive render, keeping the image it has reached
+	void StopRaytrace();
+
+	private slots:
+	// add a pass to the progressive render and show the running average
+	void RaytracePass();
 
 	protected:
 	// called when OpenGL context is set up
@@ -3,7 +3,7 @@
 ######################################################################
 
 QT+= opengl
-CONFIG+= qt debug
+CONFIG+= qt debug c++17 thread
 TEMPLATE = app
 TARGET = RaytraceRenderWindow
 INCLUDEPATH += .
@@ -22,9 +22,11 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # Input
 HEADERS += ArcBall.h \
            ArcBallWidget.h \
+           BVH.h \
            Cartesian3.h \
            Homogeneous4.h \
            Matrix4.h \
+           ObjReader.h \
            Quaternion.h \
            RayTracer.h \
            RaytraceRenderWidget.h \
@@ -34,15 +36,23 @@ HEADERS += ArcBall.h \
            RenderWindow.h \
            RGBAImage.h \
            RGBAValue.h \
+           Scene.h \
+           SceneCache.h \
            Surfel.h \
            TexturedObject.h \
-           Utils.h
+           ThreadPool.h \
+           TileScheduler.h \
+           TriangleTable.h \
+           Utils.h \
+           WideBVH.h
 SOURCES += ArcBall.cpp \
            ArcBallWidget.cpp \
+           BVH.cpp \
            Cartesian3.cpp \
            Homogeneous4.cpp \
            main.cpp \
            Matrix4.cpp \
+           ObjReader.cpp \
            Quaternion.cpp \
            RayTracer.cpp \
            RaytraceRenderWidget.cpp \
@@ -51,5 +61,11 @@ SOURCES += ArcBall.cpp \
            RenderWindow.cpp \
            RGBAImage.cpp \
            RGBAValue.cpp \
+           Scene.cpp \
+           SceneCache.cpp \
            Surfel.cpp \
-           TexturedObject.cpp
+           TexturedObject.cpp \
+           ThreadPool.cpp \
+           TileScheduler.cpp \
+           TriangleTable.cpp \
+           WideBVH.cpp
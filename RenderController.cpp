@@ -96,6 +96,18 @@ RenderController::RenderController
     QObject::connect(   renderWindow->scaleObjectBox,               SIGNAL(stateChanged(int)),
                         this,                                       SLOT(scaleObjectCheckChanged(int)));
 
+    // signal for check box for progressive rendering
+    QObject::connect(   renderWindow->progressiveRenderingBox,      SIGNAL(stateChanged(int)),
+                        this,                                       SLOT(progressiveRenderingCheckChanged(int)));
+
+    // signal for check box for adaptive sampling
+    QObject::connect(   renderWindow->adaptiveSamplingBox,          SIGNAL(stateChanged(int)),
+                        this,                                       SLOT(adaptiveSamplingCheckChanged(int)));
+
+    // signal for combo box for the acceleration structure build
+    QObject::connect(   renderWindow->bvhBuildModeBox,              SIGNAL(currentIndexChanged(int)),
+                        this,                                       SLOT(bvhBuildModeChanged(int)));
+
     // signal for rendering a ray traced image
     QObject::connect(   renderWindow->rayTraceImageButton,          SIGNAL(pressed()),
                         this,                                       SLOT(raytraceButtonPressed()));
@@ -228,6 +240,37 @@ void RenderController::scaleObjectCheckChanged(int state)
     renderWindow->ResetInterface();
     } // RenderController::scaleObjectCheckChanged()
 
+// slot for toggling progressive rendering
+void RenderController::progressiveRenderingCheckChanged(int state)
+    { // RenderController::progressiveRenderingCheckChanged()
+    // reset the model's flag
+    renderParameters->progressiveRendering = (state == Qt::Checked); 
+
+    // reset the interface
+    renderWindow->ResetInterface();
+    } // RenderController::progressiveRenderingCheckChanged()
+
+// slot for toggling adaptive sampling
+void RenderController::adaptiveSamplingCheckChanged(int state)
+    { // RenderController::adaptiveSamplingCheckChanged()
+    // reset the model's flag
+    renderParameters->adaptiveSampling = (state == Qt::Checked); 
+
+    // reset the interface
+    renderWindow->ResetInterface();
+    } // RenderController::adaptiveSamplingCheckChanged()
+
+// slot for choosing how the acceleration structure is built, the next
+// render rebuilds it
+void RenderController::bvhBuildModeChanged(int index)
+    { // RenderController::bvhBuildModeChanged()
+    // reset the model's mode
+    renderParameters->bvhBuildMode = (BVHBuildMode) index;
+
+    // reset the interface
+    renderWindow->ResetInterface();
+    } // RenderController::bvhBuildModeChanged()
+
 // slot for raytracing
 void RenderController::raytraceButtonPressed() {
     renderWindow->raytraceRenderWidget->Raytrace();
@@ -75,6 +75,11 @@ class RenderController : public QObject
     void showObjectCheckChanged(int state);
     void centreObjectCheckChanged(int state);
     void scaleObjectCheckChanged(int state);
+    void progressiveRenderingCheckChanged(int state);
+    void adaptiveSamplingCheckChanged(int state);
+
+    // slot for choosing how the acceleration structure is built
+    void bvhBuildModeChanged(int index);
     
     // slot for sample numbe change
     void sampleNumberChanged(int value);
@@ -20,6 +20,7 @@
 #define _RENDER_PARAMETERS_H
 
 #include "Matrix4.h"
+#include "BVH.h"
 
 // class for the render parameters
 class RenderParameters
@@ -34,6 +35,9 @@ class RenderParameters
 
     // and a zoom scale
     float zoomScale;
+
+    // position of the eye the raytracer looks through the image plane from
+    Cartesian3 eyePosition;
     
     // we have the position of the light
     float lightPosition[4];
@@ -45,6 +49,23 @@ class RenderParameters
 
     // samples
     float samples_;
+
+    // seed of the random numbers, the same seed renders the same image
+    unsigned int seed;
+
+    // paths stop after this many surfaces, and from the roulette depth on are
+    // ended at random depending on how much light they can still carry
+    unsigned int maxDepth;
+    unsigned int rouletteDepth;
+    // the window refines its render pass by pass until it has samples_ samples
+    // or, if the budget is above 0, has spent that many seconds
+    float renderTimeBudget;
+    // adaptive sampling spends the samples on the pixels whose estimated 
+    // error, on the 0 to 1 display scale, is above the threshold
+    float adaptiveThreshold;
+    // how the object's acceleration structure is built, a render with another
+    // mode than the object's rebuilds it first
+    BVHBuildMode bvhBuildMode;
     
     // and the various lighting parameters
     float emissiveLight;
@@ -61,6 +82,8 @@ class RenderParameters
     bool showObject;
     bool centreObject;
     bool scaleObject;
+    bool progressiveRendering;
+    bool adaptiveSampling;
 
     // constructor
     RenderParameters()
@@ -68,13 +91,22 @@ class RenderParameters
         xTranslate(0.0), 
         yTranslate(0.0),
         zoomScale(1.0),
+        eyePosition(0.0, 0.0, 3.0),
         samples_(1),
+        seed(0),
+        maxDepth(16),
+        rouletteDepth(3),
+        renderTimeBudget(0.0),
+        adaptiveThreshold(0.01),
+        bvhBuildMode(BVH_BUILD_SAH),
         useLighting(true),
         texturedRendering(false),
         textureModulation(false),
         showObject(true),
         centreObject(false),
-        scaleObject(false)
+        scaleObject(false),
+        progressiveRendering(false),
+        adaptiveSampling(false)
         { // constructor
         
         // start the lighting at the viewer's direction
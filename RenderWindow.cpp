@@ -75,6 +75,15 @@ RenderWindow::RenderWindow
     zoomSlider                  = new QSlider                   (Qt::Vertical,          this);
     
     samplesNbSlider             = new QSlider                   (Qt::Horizontal,        this);
+    progressiveRenderingBox     = new QCheckBox                 ("Progressive",         this);
+    adaptiveSamplingBox         = new QCheckBox                 ("Adaptive",            this);
+
+    // acceleration structure builds, in the order of BVHBuildMode
+    bvhBuildModeBox             = new QComboBox                 (                       this);
+    bvhBuildModeBox             ->addItem                       ("SAH BVH"                  );
+    bvhBuildModeBox             ->addItem                       ("Linear BVH"               );
+    bvhBuildModeBox             ->addItem                       ("Treelet BVH"              );
+    bvhBuildModeBox             ->addItem                       ("Spatial BVH"              );
 
     // labels for sliders and arcballs
     modelRotatorLabel           = new QLabel                    ("Model",               this);
@@ -93,6 +102,7 @@ RenderWindow::RenderWindow
     windowLayout->addWidget(raytraceRenderWidget,       0,          5,          nStacked,   1           );
 
     // the stack in the middle
+    windowLayout->addWidget(bvhBuildModeBox,            1,          3,          1,          1           );
     windowLayout->addWidget(modelRotator,               2,          3,          1,          1           );
     windowLayout->addWidget(modelRotatorLabel,          3,          3,          1,          1           );
     windowLayout->addWidget(showObjectBox,              4,          3,          1,          1           );
@@ -109,6 +119,8 @@ RenderWindow::RenderWindow
     
     // Samples Row
     windowLayout->addWidget(samplesNbSlider,            nStacked+1, 1,          1,          1           );
+    windowLayout->addWidget(progressiveRenderingBox,    nStacked+1, 3,          1,          1           );
+    windowLayout->addWidget(adaptiveSamplingBox,        nStacked+1, 5,          1,          1           );
 
     // now reset all of the control elements to match the render parameters passed in
     ResetInterface();
@@ -126,6 +138,11 @@ void RenderWindow::ResetInterface()
     showObjectBox           ->setChecked        (renderParameters   ->  showObject);
     centreObjectBox         ->setChecked        (renderParameters   ->  centreObject);
     scaleObjectBox          ->setChecked        (renderParameters   ->  scaleObject);
+    progressiveRenderingBox ->setChecked        (renderParameters   ->  progressiveRendering);
+    adaptiveSamplingBox     ->setChecked        (renderParameters   ->  adaptiveSampling);
+
+    // set the build mode
+    bvhBuildModeBox         ->setCurrentIndex   (renderParameters   ->  bvhBuildMode);
     
     // set sliders
     // x & y translate are scaled to notional unit sphere in render widgets
@@ -166,4 +183,7 @@ void RenderWindow::ResetInterface()
     showObjectBox           ->update();
     centreObjectBox         ->update();
     scaleObjectBox          ->update();
+    progressiveRenderingBox ->update();
+    adaptiveSamplingBox     ->update();
+    bvhBuildModeBox         ->update();
     } // RenderWindow::ResetInterface()
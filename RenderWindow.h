@@ -65,6 +65,14 @@ class RenderWindow : public QWidget
     QCheckBox                   *centreObjectBox;
     QCheckBox                   *scaleObjectBox;
 
+    // check box for refining the ray traced image pass by pass
+    QCheckBox                   *progressiveRenderingBox;
+    // check box for spending the samples on the noisiest pixels
+    QCheckBox                   *adaptiveSamplingBox;
+
+    // combo box for how the acceleration structure is built
+    QComboBox                   *bvhBuildModeBox;
+
     // sliders for spatial manipulation
     QSlider                     *xTranslateSlider;
     // we want one slider under each widget
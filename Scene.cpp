@@ -0,0 +1,61 @@
+#include "Scene.h"
+
+// take a ray in the scene's space into the mesh's
+Ray MeshInstance::ToMesh(const Ray& ray) const {
+    return Ray(sceneToMesh * ray.origin_, (sceneToMesh *
+        Homogeneous4(ray.direction_.x, ray.direction_.y, ray.direction_.z, 0.0f)).Vector());
+}
+
+// a scene of just the object, without a transform
+Scene::Scene(const TexturedObject* object)
+    : added_(true) {
+    Matrix4 identity;
+    identity.SetIdentity();
+    AddInstance(object, identity);
+}
+
+// place another instance of a mesh
+unsigned int Scene::AddInstance(const TexturedObject* mesh, const Matrix4& meshToScene) {
+    instances.push_back(MeshInstance());
+    instances.back().mesh = mesh;
+    SetTransform(instances.size() - 1, meshToScene);
+    added_ = true;
+    return instances.size() - 1;
+}
+
+// move an instance
+void Scene::SetTransform(unsigned int instance, const Matrix4& meshToScene) {
+    instances[instance].meshToScene = meshToScene;
+    instances[instance].sceneToMesh = meshToScene.affineInverse();
+    instances[instance].normalToScene = instances[instance].sceneToMesh.transpose();
+}
+
+// bring the top level up to date before a render. There are few instances, so
+// both are cheap next to the render, and a single thread builds them
+void Scene::Update() {
+    if (added_)
+        topLevel.Build(InstanceBounds());
+    else
+        topLevel.Refit(InstanceBounds());
+    added_ = false;
+}
+
+// the instances' bounds in the scene's space, the box around the corners of
+// each mesh's box. An empty mesh is left at its origin, where it is never hit
+std::vector<AABB> Scene::InstanceBounds() const {
+    std::vector<AABB> bounds(instances.size());
+    for (unsigned int instance = 0; instance < instances.size(); instance++) {
+        const MeshInstance& placed = instances[instance];
+        if (placed.mesh->bvh.Empty()) {
+            bounds[instance].Extend(placed.meshToScene * Cartesian3(0.0f, 0.0f, 0.0f));
+            continue;
+        }
+        AABB meshBounds = placed.mesh->bvh.Bounds();
+        for (unsigned int corner = 0; corner < 8; corner++)
+            bounds[instance].Extend(placed.meshToScene * Cartesian3(
+                (corner & 1) ? meshBounds.upper.x : meshBounds.lower.x,
+                (corner & 2) ? meshBounds.upper.y : meshBounds.lower.y,
+                (corner & 4) ? meshBounds.upper.z : meshBounds.lower.z));
+    }
+    return bounds;
+}
@@ -0,0 +1,62 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+
+#include "BVH.h"
+#include "Matrix4.h"
+#include "TexturedObject.h"
+
+// a mesh placed in the scene. The mesh, with its hierarchy and triangle table,
+// is shared by every instance of it, an instance only adds its transforms
+struct MeshInstance {
+    const TexturedObject* mesh;
+    // from the mesh's space to the scene's and back
+    Matrix4 meshToScene, sceneToMesh;
+    // takes the mesh's normals to the scene's space, the inverse transpose
+    Matrix4 normalToScene;
+
+    // take a ray in the scene's space into the mesh's. The direction is not
+    // renormalised, so the ray parameter t is the same in both spaces
+    Ray ToMesh(const Ray& ray) const;
+};
+
+// a two level scene, a top level hierarchy over instances of meshes that each
+// have their own hierarchy. The scene's space is the main object's, which the
+// render's transforms and the lights belong to, and the main object is the
+// first instance. Memory grows with the meshes, not with the instances
+class Scene {
+    public:
+        // a scene of just the object, without a transform
+        Scene(const TexturedObject* object);
+        ~Scene() {}
+
+        // place another instance of a mesh, returns its index. The mesh must
+        // outlive the scene
+        unsigned int AddInstance(const TexturedObject* mesh, const Matrix4& meshToScene);
+
+        // move an instance, the top level is only refitted for it
+        void SetTransform(unsigned int instance, const Matrix4& meshToScene);
+
+        // bring the top level up to date before a render, a full build after
+        // instances were added and a refit otherwise, which also picks up
+        // meshes whose hierarchies were rebuilt
+        void Update();
+
+        bool Empty() const { return topLevel.Empty(); }
+
+    private:
+        // the instances' bounds in the scene's space
+        std::vector<AABB> InstanceBounds() const;
+
+    public:
+        std::vector<MeshInstance> instances;
+        // the hierarchy over the instances' bounds
+        BVH topLevel;
+
+    private:
+        // whether instances were added since the last build
+        bool added_;
+};
+
+#endif
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "ObjReader.h"
+#include "SceneCache.h"
+
+// identifies a cache file
+static const char SCENE_CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t SCENE_CACHE_BYTE_ORDER = 0x01020304;
+
+// the arrays are copied as raw bytes, which is only sound while these hold
+static_assert(sizeof(Cartesian3) == 3 * sizeof(float), "Cartesian3 must stay packed");
+static_assert(sizeof(RGBAValue) == 4, "RGBAValue must stay packed");
+
+// floats and the face index of each packed triangle
+constexpr uint32_t TRIANGLE_TABLE_ENTRY_SIZE = 12 * sizeof(float) + sizeof(unsigned int);
+
+// size of the element of each section, in section order
+static const uint32_t SECTION_ELEMENT_SIZES[CACHE_SECTION_COUNT] = {
+    sizeof(Cartesian3), sizeof(Cartesian3), sizeof(Cartesian3), sizeof(Triangle),
+    sizeof(unsigned int), sizeof(RGBAValue), sizeof(Material), sizeof(Light), 1,
+    sizeof(WideBVHNode), sizeof(unsigned int), TRIANGLE_TABLE_ENTRY_SIZE };
+
+// the arrays of the packed table in the order they are stored
+static AlignedFloats TriangleTable::* const TABLE_ARRAYS[] = {
+    &TriangleTable::v0x, &TriangleTable::v0y, &TriangleTable::v0z,
+    &TriangleTable::e1x, &TriangleTable::e1y, &TriangleTable::e1z,
+    &TriangleTable::e2x, &TriangleTable::e2y, &TriangleTable::e2z,
+    &TriangleTable::nx, &TriangleTable::ny, &TriangleTable::nz };
+
+// size and modification time of a file, false if it does not exist
+static bool SourceStamp(const char* path, uint64_t& size, int64_t& time) {
+    struct stat status;
+    if ((path == nullptr) || (stat(path, &status) != 0))
+        return false;
+    size = status.st_size;
+    time = status.st_mtime;
+    return true;
+}
+
+// bytes taken by an image in the texture section
+static uint64_t TextureBytes(const RGBAImage& image) {
+    return 2 * sizeof(uint32_t) + image.width * image.height * sizeof(RGBAValue);
+}
+
+// whether the texture section holds count images and the preview texture,
+// each prefixed with its size, without running past its end
+static bool TexturesValid(const char* texture, const char* texturesEnd,
+    unsigned int count) {
+    for (unsigned int image = 0; image <= count; image++) {
+        uint32_t size[2];
+        if (texturesEnd - texture < (long) sizeof(size))
+            return false;
+        std::memcpy(size, texture, sizeof(size));
+        texture += sizeof(size);
+        uint64_t bytes = (uint64_t) size[0] * size[1] * sizeof(RGBAValue);
+        if ((uint64_t) (texturesEnd - texture) < bytes)
+            return false;
+        texture += bytes;
+    }
+    return true;
+}
+
+// a section's elements where they lie in the mapping, as aligned as in memory
+template <typename T>
+static const T* SectionData(const char* data, const SceneCacheSection& section) {
+    return reinterpret_cast<const T*>(data + section.offset);
+}
+
+// whether every face indexes the vertex data, colours, materials and textures
+// of the cache
+static bool FacesValid(const char* data, const SceneCacheHeader& header) {
+    const SceneCacheSection* sections = header.sections;
+    const Triangle* faces = SectionData<Triangle>(data, sections[CACHE_FACES]);
+    for (uint64_t face = 0; face < sections[CACHE_FACES].count; face++) {
+        const Triangle& triangle = faces[face];
+        for (unsigned int corner = 0; corner < 3; corner++)
+            if ((triangle.vertices[corner] >= sections[CACHE_VERTICES].count) ||
+                (triangle.texCoords[corner] >= sections[CACHE_TEXTURE_COORDS].count) ||
+                (triangle.normals[corner] >= sections[CACHE_NORMALS].count))
+                return false;
+        // texture ids count from 1, 0 is none
+        if ((triangle.colour >= sections[CACHE_COLOURS].count) ||
+            (triangle.material >= sections[CACHE_MATERIALS].count) ||
+            (triangle.texID > header.textureCount))
+            return false;
+    }
+    const Light* lights = SectionData<Light>(data, sections[CACHE_LIGHTS]);
+    for (uint64_t light = 0; light < sections[CACHE_LIGHTS].count; light++)
+        if (lights[light].isAreaLight &&
+            (lights[light].triangle >= sections[CACHE_FACES].count))
+            return false;
+    return true;
+}
+
+// whether the hierarchy and packed table only index the cache's faces and
+// each other. Children come after their parent and no deeper than the
+// traversal stack allows, so a traversal always ends
+static bool HierarchyValid(const char* data, const SceneCacheHeader& header) {
+    const SceneCacheSection* sections = header.sections;
+    uint64_t faceCount = sections[CACHE_FACES].count;
+    const unsigned int* primitives =
+        SectionData<unsigned int>(data, sections[CACHE_BVH_PRIMITIVES]);
+    for (uint64_t prim = 0; prim < sections[CACHE_BVH_PRIMITIVES].count; prim++)
+        if (primitives[prim] >= faceCount)
+            return false;
+    // the face indices follow the table's twelve float arrays
+    const unsigned int* tableFaces = reinterpret_cast<const unsigned int*>(
+        data + sections[CACHE_TRIANGLE_TABLE].offset +
+        12 * sections[CACHE_TRIANGLE_TABLE].count * sizeof(float));
+    for (uint64_t tri = 0; tri < header.triangleTableSize; tri++)
+        if (tableFaces[tri] >= faceCount)
+            return false;
+
+    uint64_t nodeCount = sections[CACHE_BVH_NODES].count;
+    const WideBVHNode* nodes = SectionData<WideBVHNode>(data, sections[CACHE_BVH_NODES]);
+    std::vector<unsigned int> depths(nodeCount, 0);
+    for (uint64_t nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++) {
+        const WideBVHNode& node = nodes[nodeIndex];
+        for (unsigned int child = 0; child < WIDE_BVH_WIDTH; child++) {
+            if (node.innerMask & (1u << child)) {
+                uint64_t childIndex = (uint64_t) node.childBase + node.childOffset[child];
+                if ((node.triangleCount[child] != 0) || (childIndex <= nodeIndex) ||
+                    (childIndex >= nodeCount) ||
+                    (depths[nodeIndex] + 1 >= WIDE_BVH_MAX_DEPTH))
+                    return false;
+                depths[childIndex] = std::max(depths[childIndex], depths[nodeIndex] + 1);
+            }
+            else if ((node.triangleCount[child] != 0) &&
+                ((uint64_t) node.primitiveBase + node.childOffset[child] +
+                node.triangleCount[child] > header.triangleTableSize))
+                return false;
+        }
+    }
+    return true;
+}
+
+// copy a section straight into an array
+template <typename T, typename Allocator>
+static void CopySection(const char* data, const SceneCacheSection& section,
+    std::vector<T, Allocator>& array) {
+    array.resize(section.count);
+    std::memcpy(static_cast<void*>(array.data()), data + section.offset,
+        section.count * sizeof(T));
+}
+
+// write everything a render needs from a freshly read object, sourcePath is the
+// object file it was read from. Returns false if the cache could not be written
+bool SaveSceneCache(const TexturedObject& object, const char* sourcePath,
+    const char* cachePath) {
+    SceneCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_CACHE_VERSION;
+    header.byteOrder = SCENE_CACHE_BYTE_ORDER;
+    SourceStamp(sourcePath, header.sourceSize, header.sourceTime);
+    header.centreOfGravity[0] = object.centreOfGravity.x;
+    header.centreOfGravity[1] = object.centreOfGravity.y;
+    header.centreOfGravity[2] = object.centreOfGravity.z;
+    header.objectSize = object.objectSize;
+    header.textureCount = object.textures.size();
+    header.triangleTableSize = object.triangleTable.Size();
+    header.bvhBuildMode = object.bvhBuildMode;
+
+    // the materials and lights are held through pointers, gather their values
+    std::vector<Material> materials;
+    for (const Material* material : object.materials)
+        materials.push_back(*material);
+    std::vector<Light> lights;
+    for (const Light* light : object.lights)
+        lights.push_back(*light);
+    // the images are prefixed with their size, the preview texture goes last
+    std::vector<const RGBAImage*> images(object.textures.begin(), object.textures.end());
+    images.push_back(&object.texture);
+    uint64_t textureBytes = 0;
+    for (const RGBAImage* image : images)
+        textureBytes += TextureBytes(*image);
+
+    uint64_t counts[CACHE_SECTION_COUNT] = {
+        object.vertices.size(), object.normals.size(), object.textureCoords.size(),
+        object.faces.size(), object.faceTriangles.size(), object.colours.size(),
+        materials.size(), lights.size(), textureBytes, object.bvh.nodes.size(),
+        object.bvh.primitives.size(), object.triangleTable.face.size() };
+
+    // lay the sections out after the header, each on an aligned offset
+    uint64_t offset = sizeof(header);
+    for (unsigned int section = 0; section < CACHE_SECTION_COUNT; section++) {
+        offset = (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT
+            * SCENE_CACHE_ALIGNMENT;
+        header.sections[section].offset = offset;
+        header.sections[section].count = counts[section];
+        header.sections[section].elementSize = SECTION_ELEMENT_SIZES[section];
+        offset += counts[section] * SECTION_ELEMENT_SIZES[section];
+    }
+
+    // write to a temporary file and move it into place, so a reader never
+    // maps a half written cache
+    std::string temporaryPath = std::string(cachePath) + ".tmp";
+    std::ofstream cacheFile(temporaryPath, std::ios::out | std::ios::binary);
+    if (!cacheFile.good())
+        return false;
+
+    uint64_t written = 0;
+    auto write = [&](const void* data, uint64_t bytes) {
+        cacheFile.write(static_cast<const char*>(data), bytes);
+        written += bytes;
+    };
+    // pad up to the start of a section
+    auto seek = [&](unsigned int section) {
+        static const char zeros[SCENE_CACHE_ALIGNMENT] = {0};
+        write(zeros, header.sections[section].offset - written);
+    };
+
+    write(&header, sizeof(header));
+    seek(CACHE_VERTICES);
+    write(object.vertices.data(), object.vertices.size() * sizeof(Cartesian3));
+    seek(CACHE_NORMALS);
+    write(object.normals.data(), object.normals.size() * sizeof(Cartesian3));
+    seek(CACHE_TEXTURE_COORDS);
+    write(object.textureCoords.data(), object.textureCoords.size() * sizeof(Cartesian3));
+    seek(CACHE_FACES);
+    write(object.faces.data(), object.faces.size() * sizeof(Triangle));
+    seek(CACHE_FACE_TRIANGLES);
+    write(object.faceTriangles.data(), object.faceTriangles.size() * sizeof(unsigned int));
+    seek(CACHE_COLOURS);
+    write(object.colours.data(), object.colours.size() * sizeof(RGBAValue));
+    seek(CACHE_MATERIALS);
+    write(materials.data(), materials.size() * sizeof(Material));
+    seek(CACHE_LIGHTS);
+    write(lights.data(), lights.size() * sizeof(Light));
+    seek(CACHE_TEXTURES);
+    for (const RGBAImage* image : images) {
+        uint32_t size[2] = { (uint32_t) image->width, (uint32_t) image->height };
+        write(size, sizeof(size));
+        write(image->block, image->width * image->height * sizeof(RGBAValue));
+    }
+    seek(CACHE_BVH_NODES);
+    write(object.bvh.nodes.data(), object.bvh.nodes.size() * sizeof(WideBVHNode));
+    seek(CACHE_BVH_PRIMITIVES);
+    write(object.bvh.primitives.data(),
+        object.bvh.primitives.size() * sizeof(unsigned int));
+    seek(CACHE_TRIANGLE_TABLE);
+    for (AlignedFloats TriangleTable::* array : TABLE_ARRAYS)
+        write((object.triangleTable.*array).data(),
+            (object.triangleTable.*array).size() * sizeof(float));
+    write(object.triangleTable.face.data(),
+        object.triangleTable.face.size() * sizeof(unsigned int));
+
+    cacheFile.close();
+    if (!cacheFile.good() || (std::rename(temporaryPath.c_str(), cachePath) != 0)) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// fill an empty object from a cache with one mapping and a copy per array
+bool LoadSceneCache(TexturedObject& object, const char* sourcePath,
+    const char* cachePath) {
+    MappedFile cacheFile;
+    if (!cacheFile.Open(cachePath) || (cacheFile.Size() < sizeof(SceneCacheHeader)))
+        return false;
+    const char* data = cacheFile.Data();
+    SceneCacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    // reject caches from other versions, machines or of another object file
+    if ((std::memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.version != SCENE_CACHE_VERSION) ||
+        (header.byteOrder != SCENE_CACHE_BYTE_ORDER))
+        return false;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (SourceStamp(sourcePath, sourceSize, sourceTime) &&
+        ((sourceSize != header.sourceSize) || (sourceTime != header.sourceTime)))
+        return false;
+    // or whose hierarchy is not the one asked for
+    if (header.bvhBuildMode != (uint32_t) object.bvhBuildMode)
+        return false;
+    // and any whose sections do not match this build or the file
+    for (unsigned int section = 0; section < CACHE_SECTION_COUNT; section++) {
+        const SceneCacheSection& entry = header.sections[section];
+        if ((entry.elementSize != SECTION_ELEMENT_SIZES[section]) ||
+            (entry.offset > cacheFile.Size()) ||
+            (entry.count > (cacheFile.Size() - entry.offset) / entry.elementSize))
+            return false;
+    }
+    const SceneCacheSection* sections = header.sections;
+    uint64_t paddedSize = TriangleTable::PaddedSize(header.triangleTableSize);
+    if (paddedSize != sections[CACHE_TRIANGLE_TABLE].count)
+        return false;
+    // every check is made before the object is touched, so a caller can read
+    // the object file into it instead when the cache is rejected
+    const char* texture = data + sections[CACHE_TEXTURES].offset;
+    const char* texturesEnd = texture + sections[CACHE_TEXTURES].count;
+    if (!TexturesValid(texture, texturesEnd, header.textureCount) ||
+        !FacesValid(data, header) || !HierarchyValid(data, header))
+        return false;
+
+    object.centreOfGravity = Cartesian3(header.centreOfGravity[0],
+        header.centreOfGravity[1], header.centreOfGravity[2]);
+    object.objectSize = header.objectSize;
+
+    CopySection(data, sections[CACHE_VERTICES], object.vertices);
+    CopySection(data, sections[CACHE_NORMALS], object.normals);
+    CopySection(data, sections[CACHE_TEXTURE_COORDS], object.textureCoords);
+    CopySection(data, sections[CACHE_FACES], object.faces);
+    CopySection(data, sections[CACHE_FACE_TRIANGLES], object.faceTriangles);
+    CopySection(data, sections[CACHE_COLOURS], object.colours);
+    CopySection(data, sections[CACHE_BVH_NODES], object.bvh.nodes);
+    CopySection(data, sections[CACHE_BVH_PRIMITIVES], object.bvh.primitives);
+
+    // the object starts with a default material, the cache has its own
+    std::vector<Material> materials;
+    CopySection(data, sections[CACHE_MATERIALS], materials);
+    for (Material* material : object.materials)
+        delete material;
+    object.materials.clear();
+    for (const Material& material : materials)
+        object.materials.push_back(new Material(material));
+    std::vector<Light> lights;
+    CopySection(data, sections[CACHE_LIGHTS], lights);
+    for (const Light& light : lights)
+        object.lights.push_back(new Light(light));
+
+    // images, each prefixed with its size, the preview texture comes last
+    for (unsigned int image = 0; image <= header.textureCount; image++) {
+        uint32_t size[2];
+        std::memcpy(size, texture, sizeof(size));
+        texture += sizeof(size);
+        uint64_t bytes = (uint64_t) size[0] * size[1] * sizeof(RGBAValue);
+        RGBAImage* newTexture = (image < header.textureCount) ?
+            new RGBAImage() : &object.texture;
+        if ((bytes > 0) && newTexture->Resize(size[0], size[1]))
+            std::memcpy(static_cast<void*>(newTexture->block), texture, bytes);
+        texture += bytes;
+        if (image < header.textureCount)
+            object.textures.push_back(newTexture);
+    }
+
+    // the packed table's arrays follow each other
+    const char* table = data + sections[CACHE_TRIANGLE_TABLE].offset;
+    object.triangleTable.Resize(header.triangleTableSize);
+    for (AlignedFloats TriangleTable::* array : TABLE_ARRAYS) {
+        std::memcpy((object.triangleTable.*array).data(), table, paddedSize * sizeof(float));
+        table += paddedSize * sizeof(float);
+    }
+    std::memcpy(object.triangleTable.face.data(), table, paddedSize * sizeof(unsigned int));
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include <cstdint>
+
+#include "TexturedObject.h"
+
+// bump whenever the layout of the cache or of anything stored in it changes,
+// or the builders would now give a different hierarchy for the same object
+constexpr uint32_t SCENE_CACHE_VERSION = 6;
+// sections start on cache line boundaries, so the arrays are as aligned in the
+// mapping as they are in memory
+constexpr uint64_t SCENE_CACHE_ALIGNMENT = 64;
+
+// the arrays stored in a cache, in file order
+enum SceneCacheSectionId {
+    CACHE_VERTICES,
+    CACHE_NORMALS,
+    CACHE_TEXTURE_COORDS,
+    CACHE_FACES,
+    CACHE_FACE_TRIANGLES,
+    CACHE_COLOURS,
+    CACHE_MATERIALS,
+    CACHE_LIGHTS,
+    CACHE_TEXTURES,
+    CACHE_BVH_NODES,
+    CACHE_BVH_PRIMITIVES,
+    CACHE_TRIANGLE_TABLE,
+    CACHE_SECTION_COUNT
+};
+
+// where an array lives in the file. The element size is checked on load, so a
+// cache written by a build with different structures is rejected
+struct SceneCacheSection {
+    uint64_t offset;
+    uint64_t count;
+    uint32_t elementSize;
+    uint32_t padding;
+};
+
+// the start of a cache file
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    // written as 0x01020304, reads differently on a machine of the other endianness
+    uint32_t byteOrder;
+    // size and modification time of the object file the cache was made from
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    float centreOfGravity[3];
+    float objectSize;
+    // images in the texture section, the object's preview texture comes last
+    uint32_t textureCount;
+    // triangles in the packed table, not counting its padding
+    uint32_t triangleTableSize;
+    // the BVHBuildMode the hierarchy was built with
+    uint32_t bvhBuildMode;
+    uint32_t padding;
+    SceneCacheSection sections[CACHE_SECTION_COUNT];
+};
+
+// write everything a render needs from a freshly read object, sourcePath is the
+// object file it was read from. Returns false if the cache could not be written
+bool SaveSceneCache(const TexturedObject& object, const char* sourcePath,
+    const char* cachePath);
+
+// fill an empty object from a cache with one mapping and a copy per array.
+// Returns false, leaving the object untouched to be read from sourcePath
+// instead, if the cache is missing, corrupt, from another version, older than
+// the object file or holds a hierarchy built another way than the object's
+// bvhBuildMode. A cache is corrupt if a section runs past the file or an index
+// the renderer follows runs past the array it indexes
+bool LoadSceneCache(TexturedObject& object, const char* sourcePath,
+    const char* cachePath);
+
+#endif
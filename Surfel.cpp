@@ -3,9 +3,9 @@
 #include "math.h"
 #include "Surfel.h"
 
-// interpolate surfel properties from triangle data
-void Surfel::InterpolateProperties(
-    TexturedObject* object, RenderParameters* params) {    
+// interpolate surfel properties from the data of the triangle's mesh
+void Surfel::InterpolateProperties(RenderParameters* params) {
+    const TexturedObject* object = object_;
     texCoord_ = barycentric_.alpha * object->textureCoords[triangle_->texCoords[0]] +
         barycentric_.beta * object->textureCoords[triangle_->texCoords[1]] +
         barycentric_.gamma * object->textureCoords[triangle_->texCoords[2]];
@@ -18,21 +18,23 @@ class Surfel {
     public:
         // default constructor is for a surfel object that does not exist 
         // (a surfel that does not belong to a triangle is meaningless)
-        Surfel() : triangle_(nullptr) {}
+        Surfel() : object_(nullptr), triangle_(nullptr) {}
         // when taking arguments, we have the information to create a surfel that exists
-        Surfel(const Cartesian3& intersection, Triangle* triangle, const Barycentric& barycentric) 
-            : triangle_(triangle), barycentric_(barycentric), position_(intersection) {}
+        Surfel(const Cartesian3& intersection, const TexturedObject* object,
+            const Triangle* triangle, const Barycentric& barycentric) 
+            : object_(object), triangle_(triangle), barycentric_(barycentric),
+            position_(intersection) {}
         ~Surfel() {}
 
-        // interpolate the values from the triangle data
-        void InterpolateProperties(
-            TexturedObject* object, RenderParameters* params);
+        // interpolate the values from the data of the triangle's mesh
+        void InterpolateProperties(RenderParameters* params);
         // surface BRDF at the surfel
         RGBRadiance BRDF(const Cartesian3& inDir, const Cartesian3& outDir) const;
 
     public:
-        // triangle the surfel belongs to
-        Triangle* triangle_;
+        // mesh and triangle the surfel belongs to
+        const TexturedObject* object_;
+        const Triangle* triangle_;
         // surfel barycentric coordinates
         Barycentric barycentric_;
 
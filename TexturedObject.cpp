@@ -28,20 +28,24 @@
 #include "TexturedObject.h"
 
 // include the C++ standard libraries we want
+#include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <memory>
+#include <cctype>
 #include <iomanip>
-#include <sstream>
+#include <iterator>
 #include <string>
 #include <fstream>
 
 // include the Cartesian 3- vector class
 #include "Cartesian3.h"
-
-#define MAXIMUM_LINE_LENGTH 1024
+// the threads the object file is parsed with
+#include "ThreadPool.h"
 
 // constructor will initialise to safe values
 TexturedObject::TexturedObject()
-    : centreOfGravity(0.0,0.0,0.0)
+    : bvhBuildMode(BVH_BUILD_SAH), centreOfGravity(0.0,0.0,0.0)
     { // TexturedObject()
     // force arrays to size 0
     vertices.resize(0);
@@ -66,386 +70,108 @@ TexturedObject::~TexturedObject() {
 // read routine returns true on success, failure otherwise
 bool TexturedObject::ReadObjectStream(std::istream &geometryStream, std::istream &textureStream)
     { // ReadObjectStream()
-    
-    // create a read buffer
-    char readBuffer[MAXIMUM_LINE_LENGTH];
-
-    // triangle id
-    unsigned int id = 0;
-    // default area light intensity
-    RGBRadiance areaLightIntensity;
-    // current colour
-    unsigned int currentColour = 0;
-    // current material is set to the default starting one
-    unsigned int currentMaterial = 0;
-    // current texture, 0 means "don't use texture"
-    unsigned int currentTexture = 0;
-    // current light id
-    unsigned int lightId = 1;
-
-    // the rest of this is a loop reading lines & adding them in appropriate places
-    while (true)
-        { // not eof
-        // character to read
-        char firstChar = geometryStream.get();
-        
-        // check for eof() in case we've run out
-        if (geometryStream.eof())
-            break;
-
-        // otherwise, switch on the character we read
-        switch (firstChar)
-            { // switch on first character
-            case '#':       // comment line
-                // read and discard the line
-                geometryStream.getline(readBuffer, MAXIMUM_LINE_LENGTH);
-                break;
-
-            case 'c': {     // colour line
-                RGBAValue newColour;
-                geometryStream >> newColour;
-                newColour.alpha = 255;
-                colours.push_back(newColour);
-                currentColour += 1;
-                break;
-            }
-
-            // texture entry
-            case 't': {
-                // get the next char to determine how to process line further
-                char secondChar = geometryStream.get();
-                
-                // bail if we ran out of file
-                if (geometryStream.eof())
-                    break;
-
-                switch(secondChar) {
-                    // make a new texture object
-                    case 'm': {
-                        // chomp the first space
-                        geometryStream.get();
-                        // read in the texture location
-                        geometryStream.getline(readBuffer, MAXIMUM_LINE_LENGTH);
-                        // initialise the texture object
-                        std::ifstream textureFile(readBuffer);
-                        //std::cout << readBuffer << std::endl;
-                        // create a texture object
-                        RGBAImage* newTexture = new RGBAImage();
-                        // if we can read the texture, then we add it to the textures
-                        // list
-                        if (textureFile.good() && newTexture->ReadPPM(textureFile)) {
-                            //std::cout << "read succesful" << std::endl;
-                            //std::cout << newTexture->width << std::endl;
-                            //std::cout << newTexture->height << std::endl;
-                            textures.push_back(newTexture);
-                        }
-                        break;
-                    }
-                    // use a texture
-                    case 'u': {
-                        // cast to signed int to make sure we detect negative input
-                        int texture;
-                        geometryStream >> texture;
-                        //std::cout << "use " << texture << std::endl;
-                        // which is caught here to avoid indexing errors
-                        if ((texture-1 < 0) || (texture > textures.size()))
-                            currentTexture = 0;
-                        else
-                            currentTexture = texture;
-                        break;
-                    }
-                    // stop using a texture
-                    case 's': 
-                        //std::cout << "stop using " << currentTexture << std::endl;
-                        currentTexture = 0;
-                        break;
-                }
-                break;
-            }
-
-            // light section
-            case 'l': {
-                // get the next char to determine how to process line further
-                char secondChar = geometryStream.get();
-                // bail if we ran out of file
-                if (geometryStream.eof())
-                    break;
-
-                switch (secondChar) {
-                    case 'p': {
-                        // create a light object and stream in light data depending on next character
-                        Light* light = new Light();
-                        // start with position
-                        geometryStream >> light->position.x;
-                        geometryStream >> light->position.y;
-                        geometryStream >> light->position.z;
-                        // follow with intensity
-                        float intensity;
-                        geometryStream >> intensity;
-                        RGBRadiance lightIntensity = RGBRadiance(intensity, intensity, intensity);
-                        light->intensity = lightIntensity;
-                        // end with light type
-                        geometryStream >> light->atInfinity;
-                        light->isAreaLight = false;
-                        // then push back the light
-                        lights.push_back(light);
-                        break;
-                    }
-                    // a triangle that is part of an area light
-                    case 'f': {
-                        // create a light object and stream in light data depending on next character
-                        Light* light = new Light();
-                        // set boolean flags
-                        light->atInfinity = false;
-                        light->isAreaLight = true; 
-                        // stream in the face that constitutes an area light
-                        geometryStream.getline(readBuffer, MAXIMUM_LINE_LENGTH);
-                        // turn into a C++ string
-                        std::string lineString = std::string(readBuffer);
-                        // create a string stream
-                        std::stringstream lineParse(lineString); 
-                        // parse in the face
-                        Triangle* triangle = new Triangle();
-                        unsigned int v = 0;
-                        unsigned int vertexID;
-                        while (!lineParse.eof()) {
-                            lineParse >> vertexID;
-                            triangle->vertices[v] = vertexID-1;
-                            triangle->texCoords[v] = vertexID-1;
-                            triangle->normals[v++] = vertexID-1;
-                        }
-                        // set the colour to the current one
-                        triangle->colour = currentColour;
-                        // set the triangle material to the current one
-                        triangle->material = currentMaterial;
-                        // set the triangle material to the current one
-                        triangle->texID = currentTexture;
-                        // set the triangle's id
-                        triangle->id = id++;
-                        // set the triangle to the light
-                        faces.push_back(triangle);
-                        light->triangle = triangle;
-                        light->intensity = areaLightIntensity;
-                        // keep track of area light ids
-                        triangle->lightId = lightId++;
-                        std::cout << "new light with id " << + triangle->lightId << '\n';
-                        lights.push_back(light);
-                        break;
-                    }
-                    // set the new area light intensity, where xyz are RGB
-                    case 'a': 
-                        geometryStream >> areaLightIntensity.red_;
-                        geometryStream >> areaLightIntensity.green_;
-                        geometryStream >> areaLightIntensity.blue_;
-                }
-                break;                
-            }
-
-            // material section
-            case 'm' :{
-                // get the next char to determine how to process line further
-                char secondChar = geometryStream.get();
-                
-                // bail if we ran out of file
-                if (geometryStream.eof())
-                    break;
-
-                switch (secondChar) {
-                    // create a new material object 
-                    case 'c': {
-                        Material* material = new Material();
-                        materials.push_back(material);
-                        // also increment count so setting 
-                        // material properties is for right material
-                        currentMaterial += 1;
-                        break;
-                    }
-                    // set current material emissive property
-                    case 'e': 
-                        geometryStream >> materials[currentMaterial]->emmisive[0];
-                        geometryStream >> materials[currentMaterial]->emmisive[1];
-                        geometryStream >> materials[currentMaterial]->emmisive[2];
-                        break;
-                    // set material lambertian property
-                    case 'l': 
-                        geometryStream >> materials[currentMaterial]->lambertian[0];
-                        geometryStream >> materials[currentMaterial]->lambertian[1];
-                        geometryStream >> materials[currentMaterial]->lambertian[2];
-                        break;
-                    // set material glossy property
-                    case 'g': 
-                        geometryStream >> materials[currentMaterial]->glossy[0];
-                        geometryStream >> materials[currentMaterial]->glossy[1];
-                        geometryStream >> materials[currentMaterial]->glossy[2];
-                        geometryStream >> materials[currentMaterial]->glossy[3];
-                        break;
-                    case 'i': 
-                        geometryStream >> materials[currentMaterial]->albedo[0];
-                        geometryStream >> materials[currentMaterial]->albedo[1];
-                        geometryStream >> materials[currentMaterial]->albedo[2];
-                        break;
-                    // set the material extinction coefficient
-                    case 'x':
-                        geometryStream >> materials[currentMaterial]->extinction;
-                        break;
-                    case 'I':
-                        geometryStream >> materials[currentMaterial]->extinction;
-                        break;
-                    
-                    // set current material
-                    case 'u': {
-                        // cast to signed int to make sure we detect negative input
-                        int material;
-                        geometryStream >> material;
-                        // which is caught here to avoid indexing errors
-                        if ((material-1 < 0) || (material > materials.size()))
-                            currentMaterial = 0;
-                        else
-                            currentMaterial = material;
-                        break;
-                    }
-                }
-                break;
-            }
-                
-            case 'v':       // vertex data of some type
-                { // some sort of vertex data
-                // retrieve another character
-                char secondChar = geometryStream.get();
-                
-                // bail if we ran out of file
-                if (geometryStream.eof())
-                    break;
-
-                // now use the second character to choose branch
-                switch (secondChar)
-                    { // switch on second character
-                    case ' ':       // space - indicates a vertex
-                        { // vertex read
-                        Cartesian3 vertex;
-                        geometryStream >> vertex;
-                        vertices.push_back(vertex);
-                        break;
-                        } // vertex read
-                    case 'n':       // n indicates normal vector
-                        { // normal read
-                        Cartesian3 normal;
-                        geometryStream >> normal;
-                        normals.push_back(normal);
-                        break;
-                        } // normal read
-                    case 't':       // t indicates texture coords
-                        { // tex coord
-                        Cartesian3 texCoord;
-                        geometryStream >> texCoord;
-                        textureCoords.push_back(texCoord);
-                        break;                  
-                        } // tex coord
-                    default:
-                        break;
-                    } // switch on second character 
-                break;
-                } // some sort of vertex data
-                
-            case 'f':       // face data
-                { // face
-                // a face can have an arbitrary number of vertices, which is a pain
-                // so we will create a separate buffer to read from
-                geometryStream.getline(readBuffer, MAXIMUM_LINE_LENGTH);
-
-                // turn into a C++ string
-                std::string lineString = std::string(readBuffer);
-
-                // create a string stream
-                std::stringstream lineParse(lineString); 
-
-                // create vectors for the IDs (with different names from the master arrays)
-                std::vector<unsigned int> faceVertexSet;
-                std::vector<unsigned int> faceNormalSet;
-                std::vector<unsigned int> faceTexCoordSet;
-
-                // now loop through the line
-                while (!lineParse.eof())
-                    { // lineParse isn't done
-                    // the triple of vertex, normal, tex coord IDs
-                    unsigned int vertexID;
-                    unsigned int normalID;
-                    unsigned int texCoordID;
-
-                    // try reading them in, breaking if we hit eof
-                    lineParse >> vertexID;
-                    // retrieve & discard a slash
-                    lineParse.get();
-                    // check eof
-                    if (lineParse.eof())
-                        break;
-                    
-                    // and the tex coord
-                    lineParse >> texCoordID;
-                    lineParse.get();
-                    if (lineParse.eof())
-                        break;
-                        
-                    // read normal likewise
-                    lineParse >> normalID;
-                        
-                    // if we got this far, we presumably have three valid numbers, so add them
-                    // but notice that .obj uses 1-based numbering, where our arrays use 0-based
-                    faceVertexSet.push_back(vertexID-1);
-                    faceNormalSet.push_back(normalID-1);
-                    faceTexCoordSet.push_back(texCoordID-1);
-                    } // lineParse isn't done
-
-                // as long as the face has at least three vertices, add to the master list
-                if (faceVertexSet.size() > 2)
-                    { // at least 3
-
-                    // get the number of triangles we can divide the face up in to
-                    unsigned int nTriangles = faceVertexSet.size() - 2;
-                    // loop over the triangles and create a triangle for each one
-                    for (unsigned int tri = 0; tri < nTriangles; tri++) {
-                        Triangle* triangle = new Triangle();
-                        // fan out starting at the first vertex
-                        // v1
-                        triangle->vertices[0] = faceVertexSet[0];
-                        triangle->texCoords[0] = faceTexCoordSet[0];
-                        triangle->normals[0] = faceNormalSet[0];
-                        // then set the next two vertices, incrementing for each 
-                        // new triangle
-                        // v2
-                        triangle->vertices[1] = faceVertexSet[tri + 1];
-                        triangle->texCoords[1] = faceTexCoordSet[tri + 1];
-                        triangle->normals[1] = faceNormalSet[tri + 1];
-                        // v3
-                        triangle->vertices[2] = faceVertexSet[tri + 2];
-                        triangle->texCoords[2] = faceTexCoordSet[tri + 2];
-                        triangle->normals[2] = faceNormalSet[tri + 2];
-                        // set the colour to the current one
-                        triangle->colour = currentColour;
-                        // set the triangle material to the current one
-                        triangle->material = currentMaterial;
-                        // set the triangle material to the current one
-                        triangle->texID = currentTexture;
-                        // set the triangle's id
-                        triangle->id = id++;
-                        // append the triangle to the triangles vector
-                        faces.push_back(triangle);
-                    }
-                    // keep the number of triangles in a face for writing object
-                    // to file
-                    faceTriangles.push_back(nTriangles);
-                    } // at least 3
-                
-                break;
-                } // face
-                
-            // default processing: do nothing
-            default:
-                break;
-
-            } // switch on first character
+    // read the whole stream into memory and parse it as if it were mapped
+    std::string contents((std::istreambuf_iterator<char>(geometryStream)), 
+        std::istreambuf_iterator<char>());
+    return ParseObject(contents.data(), contents.data() + contents.size(), textureStream);
+    } // ReadObjectStream()
 
-        } // not eof
+// read routine that maps the geometry file rather than streaming it
+bool TexturedObject::ReadObjectFile(const char *geometryPath, std::istream &textureStream)
+    { // ReadObjectFile()
+    MappedFile geometryFile;
+    if (!geometryFile.Open(geometryPath))
+        return false;
+    return ParseObject(geometryFile.Data(), geometryFile.Data() + geometryFile.Size(), 
+        textureStream);
+    } // ReadObjectFile()
+
+// parse a whole object file held in memory
+bool TexturedObject::ParseObject(const char *begin, const char *end, std::istream &textureStream)
+    { // ParseObject()
+    // the file is cut into runs of whole lines that are parsed in parallel, the
+    // threads only live for the read
+    ThreadPool pool;
+    std::vector<const char*> boundaries = SplitLines(begin, end, pool.Size());
+    unsigned int nChunks = boundaries.size() - 1;
+    std::vector<ObjChunk> chunks(nChunks);
+
+    // count the lines of each chunk first, so every array is allocated once and
+    // each chunk knows where its part of them starts
+    pool.Run([&](unsigned int worker) {
+        for (unsigned int chunk = worker; chunk < nChunks; chunk += pool.Size())
+            chunks[chunk].Count(boundaries[chunk], boundaries[chunk + 1]);
+    });
+    unsigned int firstFace = faces.size(), firstFaceLine = faceTriangles.size();
+    std::vector<ObjChunkTarget> targets(nChunks);
+    unsigned int nVertices = vertices.size(), nNormals = normals.size(), 
+        nTexCoords = textureCoords.size(), nFaces = firstFace, nFaceLines = firstFaceLine;
+    for (unsigned int chunk = 0; chunk < nChunks; chunk++)
+        { // per chunk
+        targets[chunk].vertexOffset = nVertices;
+        targets[chunk].normalOffset = nNormals;
+        targets[chunk].texCoordOffset = nTexCoords;
+        targets[chunk].triangleOffset = nFaces;
+        targets[chunk].faceOffset = nFaceLines;
+        nVertices += chunks[chunk].vertexCount;
+        nNormals += chunks[chunk].normalCount;
+        nTexCoords += chunks[chunk].texCoordCount;
+        nFaces += chunks[chunk].triangleCount;
+        nFaceLines += chunks[chunk].faceCount;
+        } // per chunk
+    vertices.resize(nVertices);
+    normals.resize(nNormals);
+    textureCoords.resize(nTexCoords);
+    faces.resize(nFaces);
+    faceTriangles.resize(nFaceLines);
+    for (ObjChunkTarget &target : targets)
+        { // per target
+        target.vertices = vertices.data();
+        target.normals = normals.data();
+        target.textureCoords = textureCoords.data();
+        target.triangles = faces.data();
+        target.faceTriangles = faceTriangles.data();
+        target.vertexTotal = nVertices;
+        } // per target
+
+    // then parse the geometry straight into place
+    pool.Run([&](unsigned int worker) {
+        for (unsigned int chunk = worker; chunk < nChunks; chunk += pool.Size())
+            chunks[chunk].Parse(targets[chunk]);
+    });
+
+    // and merge the chunks in file order, replaying the colour, texture, light
+    // and material lines between their triangles. Room a chunk left unused is
+    // closed up as the faces move down
+    ObjReadState state;
+    state.face = firstFace;
+    unsigned int faceLine = firstFaceLine;
+    for (unsigned int chunk = 0; chunk < nChunks; chunk++)
+        { // per chunk
+        ObjChunk &objChunk = chunks[chunk];
+        const ObjChunkTarget &target = targets[chunk];
+        if (faceLine != target.faceOffset)
+            std::copy(faceTriangles.begin() + target.faceOffset, 
+                faceTriangles.begin() + target.faceOffset + objChunk.facesParsed, 
+                faceTriangles.begin() + faceLine);
+        faceLine += objChunk.facesParsed;
+
+        unsigned int triangle = target.triangleOffset;
+        for (const ObjDirective &directive : objChunk.directives)
+            { // per directive
+            StampTriangles(triangle, target.triangleOffset + directive.position, state);
+            triangle = target.triangleOffset + directive.position + 
+                (directive.areaLightFace ? 1 : 0);
+            ReadDirective(directive, state);
+            } // per directive
+        StampTriangles(triangle, target.triangleOffset + objChunk.trianglesParsed, state);
+
+        // release the chunk as soon as it is merged
+        objChunk = ObjChunk();
+        } // per chunk
+    faces.resize(state.face);
+    faceTriangles.resize(faceLine);
+    ResolveMissingIndices(firstFace);
 
     // compute centre of gravity
     // note that very large files may have numerical problems with this
@@ -477,12 +203,304 @@ bool TexturedObject::ReadObjectStream(std::istream &geometryStream, std::istream
             } // per vertex
         } // non-empty vertex set
 
-    // now read in the texture file
-    texture.ReadPPM(textureStream);
+    // cache the area lights' geometry, the vertices they use may come after them
+    for (Light* light : lights) {
+        if (!light->isAreaLight)
+            continue;
+        light->vertex0 = vertices[faces[light->triangle].vertices[0]];
+        light->edge1 = vertices[faces[light->triangle].vertices[1]] - light->vertex0;
+        light->edge2 = vertices[faces[light->triangle].vertices[2]] - light->vertex0;
+        light->area = 0.5f * light->edge1.cross(light->edge2).length();
+    }
+
+    // build the acceleration structure once the faces are known
+    BuildAccelerationStructure(&pool);
+
+    // now read in the texture file, an empty stream means there is none
+    if (textureStream.peek() != std::char_traits<char>::eof())
+        texture.ReadPPM(textureStream);
 
     // return a success code
     return true;
-    } // ReadObjectStream()
+    } // ParseObject()
+
+// point the corners of the faces from firstFace on that have no texture
+// coordinate or normal at defaults, so every index can be followed. They share
+// a single texture coordinate at the origin, and each triangle gets its own
+// face normal
+void TexturedObject::ResolveMissingIndices(unsigned int firstFace)
+    { // ResolveMissingIndices()
+    unsigned int nTexCoords = textureCoords.size(), nNormals = normals.size();
+    unsigned int defaultTexCoord = OBJ_NO_INDEX;
+    for (unsigned int face = firstFace; face < faces.size(); face++)
+        { // per face
+        Triangle &triangle = faces[face];
+        unsigned int faceNormal = OBJ_NO_INDEX;
+        for (unsigned int corner = 0; corner < 3; corner++)
+            { // per corner
+            if (triangle.texCoords[corner] >= nTexCoords)
+                {
+                if (defaultTexCoord == OBJ_NO_INDEX)
+                    {
+                    defaultTexCoord = textureCoords.size();
+                    textureCoords.push_back(Cartesian3(0.0f, 0.0f, 0.0f));
+                    }
+                triangle.texCoords[corner] = defaultTexCoord;
+                }
+            if (triangle.normals[corner] >= nNormals)
+                {
+                if (faceNormal == OBJ_NO_INDEX)
+                    {
+                    const Cartesian3 &vertex0 = vertices[triangle.vertices[0]];
+                    Cartesian3 normal = (vertices[triangle.vertices[1]] - vertex0).cross(
+                        vertices[triangle.vertices[2]] - vertex0);
+                    // a degenerate triangle has no direction to face
+                    if (normal.length() > 0.0f)
+                        normal = normal.unit();
+                    faceNormal = normals.size();
+                    normals.push_back(normal);
+                    }
+                triangle.normals[corner] = faceNormal;
+                }
+            } // per corner
+        } // per face
+    } // ResolveMissingIndices()
+
+// build the acceleration structure from the current faces, a binary hierarchy
+// collapsed into a wide one, then pack the triangles in leaf order so each leaf
+// reads a contiguous range. Call again after editing the geometry
+void TexturedObject::BuildAccelerationStructure(ThreadPool *pool)
+    { // BuildAccelerationStructure()
+    // threads only live for the build if the caller has none to lend
+    std::unique_ptr<ThreadPool> buildPool;
+    if (pool == nullptr)
+        {
+        buildPool.reset(new ThreadPool());
+        pool = buildPool.get();
+        }
+
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    BVH binary;
+    binary.Build(vertices, faces, pool, bvhBuildMode);
+    bvh.Build(binary, vertices, faces, pool);
+    triangleTable.Build(vertices, faces, bvh.primitives, pool);
+    auto buildEnd = std::chrono::high_resolution_clock::now();
+    std::cout << "BVH build took: " <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(buildEnd - buildStart).count()
+        << "ms, SAH cost " << binary.SAHCost() << "." << std::endl;
+    } // BuildAccelerationStructure()
+
+// stamp the reader's state on the parsed faces in [begin, end) and move them
+// down to the next face, which is never after them
+void TexturedObject::StampTriangles(unsigned int begin, unsigned int end, 
+    ObjReadState &state)
+    { // StampTriangles()
+    for (unsigned int tri = begin; tri < end; tri++)
+        { // per triangle
+        Triangle triangle = faces[tri];
+        // set the colour, material and texture to the current ones
+        triangle.colour = state.colour;
+        triangle.material = state.material;
+        triangle.texID = state.texture;
+        // set the triangle's id
+        triangle.id = state.id++;
+        faces[state.face++] = triangle;
+        } // per triangle
+    } // StampTriangles()
+
+// apply a colour, texture, light or material line to the reader's state
+void TexturedObject::ReadDirective(const ObjDirective &directive, ObjReadState &state)
+    { // ReadDirective()
+    const char *cursor = directive.begin;
+    const char *end = directive.end;
+    // the first two characters select what the line sets
+    char firstChar = *cursor++;
+    char secondChar = (cursor < end) ? *cursor++ : '\0';
+    
+    switch (firstChar)
+        { // switch on first character
+        case 'c': {     // colour line
+            // the second character is the separating blank
+            cursor--;
+            int red = 0, green = 0, blue = 0;
+            ParseInt(cursor, end, red);
+            ParseInt(cursor, end, green);
+            ParseInt(cursor, end, blue);
+            colours.push_back(RGBAValue((unsigned char) red, (unsigned char) green, 
+                (unsigned char) blue, 255));
+            state.colour += 1;
+            break;
+        }
+
+        // texture entry
+        case 't': 
+            switch(secondChar) {
+                // make a new texture object
+                case 'm': {
+                    // the rest of the line is the texture location
+                    const char *pathEnd = end;
+                    while ((pathEnd > cursor) && std::isspace((unsigned char) pathEnd[-1]))
+                        pathEnd--;
+                    std::string path(SkipBlanks(cursor, pathEnd), pathEnd);
+                    // initialise the texture object
+                    std::ifstream textureFile(path, std::ios::binary);
+                    // create a texture object
+                    RGBAImage* newTexture = new RGBAImage();
+                    // if we can read the texture, then we add it to the textures
+                    // list
+                    if (textureFile.good() && newTexture->ReadPPM(textureFile))
+                        textures.push_back(newTexture);
+                    else
+                        delete newTexture;
+                    break;
+                }
+                // use a texture
+                case 'u': {
+                    // signed int to make sure we detect negative input
+                    int texture = 0;
+                    ParseInt(cursor, end, texture);
+                    // which is caught here to avoid indexing errors
+                    if ((texture-1 < 0) || (texture > (int) textures.size()))
+                        state.texture = 0;
+                    else
+                        state.texture = texture;
+                    break;
+                }
+                // stop using a texture
+                case 's': 
+                    state.texture = 0;
+                    break;
+            }
+            break;
+
+        // light section
+        case 'l':
+            switch (secondChar) {
+                case 'p': {
+                    // create a light object, starting with position
+                    Light* light = new Light();
+                    ParseFloat(cursor, end, light->position.x);
+                    ParseFloat(cursor, end, light->position.y);
+                    ParseFloat(cursor, end, light->position.z);
+                    // follow with intensity
+                    float intensity = 0.0f;
+                    ParseFloat(cursor, end, intensity);
+                    light->intensity = RGBRadiance(intensity, intensity, intensity);
+                    // end with light type
+                    int atInfinity = 0;
+                    ParseInt(cursor, end, atInfinity);
+                    light->atInfinity = atInfinity;
+                    light->isAreaLight = false;
+                    // then push back the light
+                    lights.push_back(light);
+                    break;
+                }
+                // a triangle that is part of an area light
+                case 'f': {
+                    // the chunk left no room for the face
+                    if (!directive.areaLightFace)
+                        return;
+                    // parse in the face, which uses the same index for all of the
+                    // vertex data
+                    Triangle triangle;
+                    int vertexID;
+                    for (unsigned int v = 0; v < 3; v++)
+                        { // per vertex
+                        if (!ParseInt(cursor, end, vertexID) || (vertexID < 1) || 
+                            (vertexID > (int) vertices.size()))
+                            return;
+                        triangle.vertices[v] = vertexID-1;
+                        triangle.texCoords[v] = vertexID-1;
+                        triangle.normals[v] = vertexID-1;
+                        } // per vertex
+                    // set the colour, material and texture to the current ones
+                    triangle.colour = state.colour;
+                    triangle.material = state.material;
+                    triangle.texID = state.texture;
+                    // set the triangle's id
+                    triangle.id = state.id++;
+                    // keep track of area light ids
+                    triangle.lightId = state.lightId++;
+                    faces[state.face] = triangle;
+
+                    // create a light object for the face
+                    Light* light = new Light();
+                    light->atInfinity = false;
+                    light->isAreaLight = true; 
+                    light->triangle = state.face++;
+                    light->intensity = state.areaLightIntensity;
+                    std::cout << "new light with id " << + triangle.lightId << '\n';
+                    lights.push_back(light);
+                    break;
+                }
+                // set the new area light intensity, where xyz are RGB
+                case 'a': 
+                    ParseFloat(cursor, end, state.areaLightIntensity.red_);
+                    ParseFloat(cursor, end, state.areaLightIntensity.green_);
+                    ParseFloat(cursor, end, state.areaLightIntensity.blue_);
+                    break;
+            }
+            break;                
+
+        // material section
+        case 'm': {
+            Material *material = materials[state.material];
+            switch (secondChar) {
+                // create a new material object 
+                case 'c': 
+                    materials.push_back(new Material());
+                    // also increment count so setting 
+                    // material properties is for right material
+                    state.material += 1;
+                    break;
+                // set current material emissive property
+                case 'e': 
+                    for (unsigned int i = 0; i < 3; i++)
+                        ParseFloat(cursor, end, material->emmisive[i]);
+                    break;
+                // set material lambertian property
+                case 'l': 
+                    for (unsigned int i = 0; i < 3; i++)
+                        ParseFloat(cursor, end, material->lambertian[i]);
+                    break;
+                // set material glossy property
+                case 'g': 
+                    for (unsigned int i = 0; i < 4; i++)
+                        ParseFloat(cursor, end, material->glossy[i]);
+                    break;
+                case 'i': 
+                    for (unsigned int i = 0; i < 3; i++)
+                        ParseFloat(cursor, end, material->albedo[i]);
+                    break;
+                // set the material extinction coefficient
+                case 'x':
+                    ParseFloat(cursor, end, material->extinction);
+                    break;
+                case 'I':
+                    ParseFloat(cursor, end, material->extinction);
+                    break;
+                
+                // set current material
+                case 'u': {
+                    // signed int to make sure we detect negative input
+                    int materialID = 0;
+                    ParseInt(cursor, end, materialID);
+                    // which is caught here to avoid indexing errors
+                    if ((materialID-1 < 0) || (materialID >= (int) materials.size()))
+                        state.material = 0;
+                    else
+                        state.material = materialID;
+                    break;
+                }
+            }
+            break;
+        }
+
+        // default processing: do nothing
+        default:
+            break;
+        } // switch on first character
+    } // ReadDirective()
 
 // write routine
 void TexturedObject::WriteObjectStream(std::ostream &geometryStream, std::ostream &textureStream)
@@ -514,15 +532,15 @@ void TexturedObject::WriteObjectStream(std::ostream &geometryStream, std::ostrea
         // add the first two vertices vertex of the face
         for (unsigned int i = 0; i < 2; i++)
             geometryStream 
-                << faces[currTriangle]->vertices[i]+1 << "/" 
-                << faces[currTriangle]->texCoords[i]+1 << "/" 
-                << faces[currTriangle]->normals[i]+1 << " ";
+                << faces[currTriangle].vertices[i]+1 << "/" 
+                << faces[currTriangle].texCoords[i]+1 << "/" 
+                << faces[currTriangle].normals[i]+1 << " ";
         // loop for each triangle in the face, add the third vertex
         for (unsigned int tri = 0; tri < faceTriangles[face]; tri++) {
             geometryStream 
-                << faces[currTriangle]->vertices[2]+1 << "/" 
-                << faces[currTriangle]->texCoords[2]+1 << "/" 
-                << faces[currTriangle]->normals[2]+1 << " ";
+                << faces[currTriangle].vertices[2]+1 << "/" 
+                << faces[currTriangle].texCoords[2]+1 << "/" 
+                << faces[currTriangle].normals[2]+1 << " ";
             // increment current triangle counter
             currTriangle++;
         }
@@ -534,6 +552,7 @@ void TexturedObject::WriteObjectStream(std::ostream &geometryStream, std::ostrea
     texture.WritePPM(textureStream);
     } // WriteObjectStream()
 
+#ifndef HEADLESS
 // routine to transfer assets to GPU
 void TexturedObject::TransferAssetsToGPU()
     { // TransferAssetsToGPU()
@@ -637,31 +656,31 @@ void TexturedObject::Render(RenderParameters *renderParameters)
     for (unsigned int face = 0; face < faces.size(); face++) {
         // set colour
         glColor3f(
-            colours[faces[face]->colour].red, 
-            colours[faces[face]->colour].green,
-            colours[faces[face]->colour].blue);
+            colours[faces[face].colour].red, 
+            colours[faces[face].colour].green,
+            colours[faces[face].colour].blue);
         // then set vertices
         for (unsigned int i = 0; i < 3; i++) {
             glNormal3f(
-                normals[faces[face]->normals[i]].x, 
-                normals[faces[face]->normals[i]].y,
-                normals[faces[face]->normals[i]].z);
+                normals[faces[face].normals[i]].x, 
+                normals[faces[face].normals[i]].y,
+                normals[faces[face].normals[i]].z);
             /*
             if (renderParameters->mapUVWToRGB) { // set colour and material
                 // cast Cartesian3 to float and use pointer to access data
-                float *colourPointer = (float *) &(textureCoords[faces[face]->texCoords[i]]);
+                float *colourPointer = (float *) &(textureCoords[faces[face].texCoords[i]]);
                 glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, colourPointer);
                 glMaterialfv(GL_FRONT, GL_SPECULAR, colourPointer);
                 glColor3fv(colourPointer);
             }
             */
             glTexCoord2f(
-                textureCoords[faces[face]->texCoords[i]].x,
-                textureCoords[faces[face]->texCoords[i]].y);
+                textureCoords[faces[face].texCoords[i]].x,
+                textureCoords[faces[face].texCoords[i]].y);
             glVertex3f(
-                scale * vertices[faces[face]->vertices[i]].x,
-                scale * vertices[faces[face]->vertices[i]].y,
-                scale * vertices[faces[face]->vertices[i]].z);
+                scale * vertices[faces[face].vertices[i]].x,
+                scale * vertices[faces[face].vertices[i]].y,
+                scale * vertices[faces[face].vertices[i]].z);
         }
         
     }
@@ -674,4 +693,4 @@ void TexturedObject::Render(RenderParameters *renderParameters)
         glDisable(GL_TEXTURE_2D);
 
     } // Render()
-
+#endif
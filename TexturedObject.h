@@ -31,11 +31,14 @@
 // include the C++ standard libraries we need for the header
 #include <vector>
 #include <iostream>
+// the batch renderer is built without OpenGL
+#ifndef HEADLESS
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
 #else
 #include <GL/gl.h>
 #endif
+#endif
 
 // include the unit with Cartesian 3-vectors
 #include "Cartesian3.h"
@@ -45,6 +48,12 @@
 #include "RGBAImage.h"
 // the header containing the Lights definition
 #include "Utils.h"
+// the acceleration structure used by the raytracer
+#include "WideBVH.h"
+// the packed triangles the raytracer intersects
+#include "TriangleTable.h"
+// the parallel parser for the object file
+#include "ObjReader.h"
 
 class TexturedObject
     { // class TexturedObject
@@ -59,7 +68,7 @@ class TexturedObject
     std::vector<Cartesian3> textureCoords;
 
     // vector of faces as triangles
-    std::vector<Triangle*> faces;
+    std::vector<Triangle> faces;
 
     // vector of materials used in the object
     std::vector<Material*> materials;
@@ -75,11 +84,21 @@ class TexturedObject
 
     std::vector<RGBAImage*> textures;
 
+    // wide bounding volume hierarchy over the faces, built after reading
+    WideBVH bvh;
+    // how the hierarchy is built, set before reading the object
+    BVHBuildMode bvhBuildMode;
+
+    // the faces packed in the order the hierarchy's leaves reference them
+    TriangleTable triangleTable;
+
     // RGBA Image for storing a texture
     RGBAImage texture;
 
+#ifndef HEADLESS
     // a variable to store the texture's ID on the GPU
     GLuint textureID;
+#endif
 
     // centre of gravity - computed after reading
     Cartesian3 centreOfGravity;
@@ -92,17 +111,41 @@ class TexturedObject
     // destructor will erase the dynamically created vector of triangles
     ~TexturedObject();
     
-    // read routine returns true on success, failure otherwise
+    // read routine returns true on success, failure otherwise. An empty texture
+    // stream leaves the object without a preview texture
     bool ReadObjectStream(std::istream &geometryStream, std::istream &textureStream);
 
+    // read routine that maps the geometry file rather than streaming it
+    bool ReadObjectFile(const char *geometryPath, std::istream &textureStream);
+
+    // parse a whole object file held in memory
+    bool ParseObject(const char *begin, const char *end, std::istream &textureStream);
+
+    // build the acceleration structure from the current faces, on the pool's
+    // threads or on threads of its own without one
+    void BuildAccelerationStructure(ThreadPool *pool = nullptr);
+
+    // stamp the reader's state on the parsed faces in [begin, end) and move them
+    // down to the next face
+    void StampTriangles(unsigned int begin, unsigned int end, ObjReadState &state);
+
+    // point the corners of the faces from firstFace on that have no texture
+    // coordinate or normal, or one past the end of the file's, at defaults
+    void ResolveMissingIndices(unsigned int firstFace);
+
+    // apply a colour, texture, light or material line to the reader's state
+    void ReadDirective(const ObjDirective &directive, ObjReadState &state);
+
     // write routine
     void WriteObjectStream(std::ostream &geometryStream, std::ostream &textureStream);
 
+#ifndef HEADLESS
     // routine to transfer assets to GPU
     void TransferAssetsToGPU();
     
     // routine to render
     void Render(RenderParameters *renderParameters);
+#endif
 
     }; // class TexturedObject
 
@@ -0,0 +1,69 @@
+#include "ThreadPool.h"
+
+// start nThreads - 1 worker threads, 0 means one per hardware thread
+ThreadPool::ThreadPool(unsigned int nThreads)
+    : job_(nullptr), generation_(0), busyWorkers_(0), stopping_(false) {
+    if (nThreads == 0)
+        nThreads = std::thread::hardware_concurrency();
+    // hardware_concurrency() may return 0 when it cannot tell
+    if (nThreads == 0)
+        nThreads = 1;
+    // the calling thread is the last worker
+    for (unsigned int thread = 0; thread < nThreads - 1; thread++)
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, thread);
+}
+
+// wakes the workers up and joins them
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    jobStarted_.notify_all();
+    for (unsigned int thread = 0; thread < workers_.size(); thread++)
+        workers_[thread].join();
+}
+
+// run a job on every worker, returns once all of them have finished
+void ThreadPool::Run(const std::function<void(unsigned int)>& job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &job;
+        busyWorkers_ = workers_.size();
+        generation_++;
+    }
+    jobStarted_.notify_all();
+
+    // do our share of the work as the last worker
+    job(workers_.size());
+
+    // then wait for the others
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobFinished_.wait(lock, [this] { return busyWorkers_ == 0; });
+    job_ = nullptr;
+}
+
+// loop waiting for jobs until the pool is destroyed
+void ThreadPool::WorkerLoop(unsigned int index) {
+    unsigned long lastGeneration = 0;
+    while (true) {
+        const std::function<void(unsigned int)>* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            jobStarted_.wait(lock,
+                [&] { return stopping_ || (generation_ != lastGeneration); });
+            if (stopping_)
+                return;
+            lastGeneration = generation_;
+            job = job_;
+        }
+
+        (*job)(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busyWorkers_--;
+        }
+        jobFinished_.notify_one();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a pool of long lived worker threads that run render jobs. A job is run once
+// per worker with the worker's index, the thread submitting it takes part as
+// the last worker so no core sits idle waiting for the others
+class ThreadPool {
+    public:
+        // start nThreads - 1 worker threads, 0 means one per hardware thread
+        ThreadPool(unsigned int nThreads = 0);
+        // wakes the workers up and joins them
+        ~ThreadPool();
+
+        // run a job on every worker, returns once all of them have finished
+        void Run(const std::function<void(unsigned int)>& job);
+
+        // number of threads taking part in a job, including the caller
+        unsigned int Size() const { return workers_.size() + 1; }
+
+    private:
+        // loop waiting for jobs until the pool is destroyed
+        void WorkerLoop(unsigned int index);
+
+        std::vector<std::thread> workers_;
+        // guards everything below
+        std::mutex mutex_;
+        // signalled when a new job starts and when the last worker is done
+        std::condition_variable jobStarted_, jobFinished_;
+        // the current job, its generation and the workers still running it
+        const std::function<void(unsigned int)>* job_;
+        unsigned long generation_;
+        unsigned int busyWorkers_;
+        bool stopping_;
+};
+
+// threads a job runs on, one without a pool
+inline unsigned int SliceCount(ThreadPool* pool) {
+    return (pool != nullptr) ? pool->Size() : 1;
+}
+
+// where a thread's part of the items in [begin, begin + count) starts
+inline unsigned int SliceStart(unsigned int begin, unsigned int count,
+    unsigned int slice, unsigned int nSlices) {
+    return begin + (unsigned int) ((uint64_t) count * slice / nSlices);
+}
+
+// run a job once per thread of the pool, or once on this thread without one
+inline void RunSlices(ThreadPool* pool, const std::function<void(unsigned int)>& job) {
+    if (pool != nullptr)
+        pool->Run(job);
+    else
+        job(0);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "TileScheduler.h"
+
+TileScheduler::TileScheduler(long width, long height, unsigned int nWorkers,
+    long tileSize)
+    : queues_(nWorkers > 0 ? nWorkers : 1), tileCount_(0) {
+    // cut the image into tiles in scanline order, the last row and column of
+    // tiles are clipped to the image so every pixel belongs to exactly one tile
+    std::vector<Tile> tiles;
+    for (long row = 0; row < height; row += tileSize)
+        for (long col = 0; col < width; col += tileSize)
+            tiles.push_back(Tile{row, std::min(row + tileSize, height),
+                col, std::min(col + tileSize, width)});
+    tileCount_ = tiles.size();
+
+    // give each worker a contiguous run of tiles so neighbouring tiles, which
+    // tend to hit the same geometry, are rendered by the same core
+    unsigned long tilesPerWorker = tileCount_ / queues_.size();
+    unsigned long leftOver = tileCount_ % queues_.size();
+    unsigned long tile = 0;
+    for (unsigned int worker = 0; worker < queues_.size(); worker++) {
+        unsigned long count = tilesPerWorker + (worker < leftOver ? 1 : 0);
+        queues_[worker].tiles.assign(tiles.begin() + tile, tiles.begin() + tile + count);
+        tile += count;
+    }
+}
+
+// get the next tile for a worker, returns false when the image is done
+bool TileScheduler::NextTile(unsigned int worker, Tile& tile) {
+    if (PopOwn(worker, tile))
+        return true;
+    // out of work, so go through the other queues in turn, starting with the
+    // next worker so thieves spread over different victims
+    for (unsigned int offset = 1; offset < queues_.size(); offset++)
+        if (Steal((worker + offset) % queues_.size(), tile))
+            return true;
+    // tiles are never added during a render, so every queue is empty for good
+    return false;
+}
+
+// pop from the front of a worker's own queue
+bool TileScheduler::PopOwn(unsigned int worker, Tile& tile) {
+    WorkQueue& queue = queues_[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tiles.empty())
+        return false;
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+// pop from the back of another worker's queue, the tiles furthest from the ones
+// its owner is working on
+bool TileScheduler::Steal(unsigned int victim, Tile& tile) {
+    WorkQueue& queue = queues_[victim];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tiles.empty())
+        return false;
+    tile = queue.tiles.back();
+    queue.tiles.pop_back();
+    return true;
+}
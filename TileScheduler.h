@@ -0,0 +1,49 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// default width and height of a tile in pixels
+constexpr long TILE_SIZE = 16;
+
+// a rectangle of pixels [rowBegin, rowEnd) x [colBegin, colEnd)
+struct Tile {
+    long rowBegin, rowEnd;
+    long colBegin, colEnd;
+};
+
+// cuts an image into tiles and deals them out to the workers of a render. Each
+// worker takes tiles from the front of its own queue and, once that is empty,
+// steals from the back of the others' until no tile is left
+class TileScheduler {
+    public:
+        TileScheduler(long width, long height, unsigned int nWorkers,
+            long tileSize = TILE_SIZE);
+        ~TileScheduler() {}
+
+        // get the next tile for a worker, returns false when the image is done
+        bool NextTile(unsigned int worker, Tile& tile);
+
+        // total number of tiles the image was cut into
+        unsigned long TileCount() const { return tileCount_; }
+
+    private:
+        // one queue per worker, padded to a cache line so the locks don't
+        // share one
+        struct alignas(64) WorkQueue {
+            std::mutex mutex;
+            std::deque<Tile> tiles;
+        };
+
+        // pop from the front of a worker's own queue
+        bool PopOwn(unsigned int worker, Tile& tile);
+        // pop from the back of another worker's queue
+        bool Steal(unsigned int victim, Tile& tile);
+
+        std::vector<WorkQueue> queues_;
+        unsigned long tileCount_;
+};
+
+#endif
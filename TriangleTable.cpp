@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(TRIANGLE_TABLE_SCALAR)
+#define TRIANGLE_TABLE_SIMD
+#include <immintrin.h>
+#endif
+
+#include "ThreadPool.h"
+#include "TriangleTable.h"
+
+// length of the arrays of a table of size triangles. A batch starting at the
+// last triangle still has to be loaded whole, so there is at least one batch 
+// of padding less a triangle
+unsigned int TriangleTable::PaddedSize(unsigned int size) {
+    return (size + 2 * TRIANGLE_TABLE_PADDING - 2)
+        / TRIANGLE_TABLE_PADDING * TRIANGLE_TABLE_PADDING;
+}
+
+// make room for size triangles plus the padding, all zero
+void TriangleTable::Resize(unsigned int size) {
+    size_ = size;
+    // padding triangles are degenerate (all zero) so they can never be hit
+    unsigned int paddedSize = PaddedSize(size_);
+    AlignedFloats* arrays[] = {
+        &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z, &nx, &ny, &nz };
+    for (AlignedFloats* array : arrays)
+        array->assign(paddedSize, 0.0f);
+    face.assign(paddedSize, 0);
+}
+
+// fill the table with the faces in the given order, each thread filling a
+// part of it. The arrays are not cleared first, only the padding is zeroed
+void TriangleTable::Build(const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, const std::vector<unsigned int>& order,
+    ThreadPool* pool) {
+    size_ = order.size();
+    unsigned int paddedSize = PaddedSize(size_);
+    AlignedFloats* arrays[] = {
+        &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z, &nx, &ny, &nz };
+    for (AlignedFloats* array : arrays) {
+        array->clear();
+        array->resize(paddedSize);
+        std::fill(array->begin() + size_, array->end(), 0.0f);
+    }
+    face.resize(paddedSize);
+    std::fill(face.begin() + size_, face.end(), 0u);
+
+    unsigned int nSlices = SliceCount(pool);
+    RunSlices(pool, [&](unsigned int slice) {
+        unsigned int sliceEnd = SliceStart(0, size_, slice + 1, nSlices);
+        for (unsigned int tri = SliceStart(0, size_, slice, nSlices); tri < sliceEnd; tri++) {
+            const Triangle& triangle = faces[order[tri]];
+            Cartesian3 v0 = vertices[triangle.vertices[0]];
+            Cartesian3 edge1 = vertices[triangle.vertices[1]] - v0;
+            Cartesian3 edge2 = vertices[triangle.vertices[2]] - v0;
+            // degenerate triangles keep a zero normal rather than a NaN one
+            Cartesian3 normal = edge1.cross(edge2);
+            if (normal.length() > 0.0f)
+                normal = normal.unit();
+
+            v0x[tri] = v0.x; v0y[tri] = v0.y; v0z[tri] = v0.z;
+            e1x[tri] = edge1.x; e1y[tri] = edge1.y; e1z[tri] = edge1.z;
+            e2x[tri] = edge2.x; e2y[tri] = edge2.y; e2z[tri] = edge2.z;
+            nx[tri] = normal.x; ny[tri] = normal.y; nz[tri] = normal.z;
+            face[tri] = order[tri];
+        }
+    });
+}
+
+// the tests below all follow Moller-Trumbore with the precomputed edges, and 
+// every version does the same float operations in the same order, so they 
+// find exactly the same hits
+
+#ifndef TRIANGLE_TABLE_SIMD
+
+// one triangle at a time, for machines without vector units
+static bool ClosestHitScalar(const TriangleTable& table, const Ray& ray,
+    unsigned int first, unsigned int count, TriangleHit& hit) {
+    bool found = false;
+    for (unsigned int tri = first; tri < first + count; tri++) {
+        // skip back facing triangles
+        float rayDotNormal = ray.direction_.dot(table.Normal(tri));
+        if (rayDotNormal > EPSILON)
+            continue;
+
+        Cartesian3 edge1 = table.Edge1(tri), edge2 = table.Edge2(tri);
+        Cartesian3 p = ray.direction_.cross(edge2);
+        float determinant = edge1.dot(p);
+        // ray is parallel to the plane so definitely no intersection
+        if (std::fabs(determinant) < std::numeric_limits<float>::min())
+            continue;
+        float inverseDeterminant = 1.0f / determinant;
+
+        Cartesian3 s = ray.origin_ - table.Vertex0(tri);
+        float beta = s.dot(p) * inverseDeterminant;
+        if ((beta < 0.0f) || (beta > 1.0f))
+            continue;
+        Cartesian3 q = s.cross(edge1);
+        float gamma = ray.direction_.dot(q) * inverseDeterminant;
+        if ((gamma < 0.0f) || (beta + gamma > 1.0f))
+            continue;
+
+        // ignore hits behind the ray and further than the current one
+        float t = edge2.dot(q) * inverseDeterminant;
+        if ((t < 0.0f) || (t >= hit.t))
+            continue;
+        hit.t = t;
+        hit.tri = tri;
+        hit.beta = beta;
+        hit.gamma = gamma;
+        found = true;
+    }
+    return found;
+}
+
+static bool AnyHitScalar(const TriangleTable& table, const Ray& ray,
+    unsigned int first, unsigned int count, float tMin, float tMax) {
+    for (unsigned int tri = first; tri < first + count; tri++) {
+        Cartesian3 edge1 = table.Edge1(tri), edge2 = table.Edge2(tri);
+        Cartesian3 p = ray.direction_.cross(edge2);
+        float determinant = edge1.dot(p);
+        // a ray in the plane of the triangle cannot be blocked by it
+        if (std::fabs(determinant) < std::numeric_limits<float>::min())
+            continue;
+        float inverseDeterminant = 1.0f / determinant;
+
+        Cartesian3 s = ray.origin_ - table.Vertex0(tri);
+        float beta = s.dot(p) * inverseDeterminant;
+        if ((beta < 0.0f) || (beta > 1.0f))
+            continue;
+        Cartesian3 q = s.cross(edge1);
+        float gamma = ray.direction_.dot(q) * inverseDeterminant;
+        if ((gamma < 0.0f) || (beta + gamma > 1.0f))
+            continue;
+
+        float t = edge2.dot(q) * inverseDeterminant;
+        if ((t > tMin) && (t < tMax))
+            return true;
+    }
+    return false;
+}
+
+#else
+
+// the lanes that passed a batch's tests are taken in triangle order, so ties 
+// and the closest hit come out as they do one triangle at a time
+static bool TakeClosestLanes(unsigned int batch, unsigned int lanes, const float* t,
+    const float* beta, const float* gamma, TriangleHit& hit) {
+    bool found = false;
+    for (unsigned int lane = 0; lanes != 0; lane++, lanes >>= 1) {
+        if (!(lanes & 1) || (t[lane] >= hit.t))
+            continue;
+        hit.t = t[lane];
+        hit.tri = batch + lane;
+        hit.beta = beta[lane];
+        hit.gamma = gamma[lane];
+        found = true;
+    }
+    return found;
+}
+
+// lanes of a batch of count triangles that hold one
+static inline unsigned int BatchLanes(unsigned int count, unsigned int width) {
+    return count >= width ? (1u << width) - 1 : (1u << count) - 1;
+}
+
+// four triangles at a time with SSE, which every x86-64 processor has. The 
+// tests reject rather than accept so NaNs pass them as in the scalar version
+static bool ClosestHitSSE(const TriangleTable& table, const Ray& ray,
+    unsigned int first, unsigned int count, TriangleHit& hit) {
+    const __m128 dx = _mm_set1_ps(ray.direction_.x), dy = _mm_set1_ps(ray.direction_.y),
+        dz = _mm_set1_ps(ray.direction_.z);
+    const __m128 ox = _mm_set1_ps(ray.origin_.x), oy = _mm_set1_ps(ray.origin_.y),
+        oz = _mm_set1_ps(ray.origin_.z);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 epsilon = _mm_set1_ps(EPSILON);
+    const __m128 smallest = _mm_set1_ps(std::numeric_limits<float>::min());
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+
+    bool found = false;
+    for (unsigned int batch = first; batch < first + count; batch += 4) {
+        __m128 rayDotNormal = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(dx, _mm_loadu_ps(&table.nx[batch])),
+            _mm_mul_ps(dy, _mm_loadu_ps(&table.ny[batch]))),
+            _mm_mul_ps(dz, _mm_loadu_ps(&table.nz[batch])));
+        __m128 reject = _mm_cmpgt_ps(rayDotNormal, epsilon);
+
+        __m128 e1x = _mm_loadu_ps(&table.e1x[batch]), e1y = _mm_loadu_ps(&table.e1y[batch]),
+            e1z = _mm_loadu_ps(&table.e1z[batch]);
+        __m128 e2x = _mm_loadu_ps(&table.e2x[batch]), e2y = _mm_loadu_ps(&table.e2y[batch]),
+            e2z = _mm_loadu_ps(&table.e2z[batch]);
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 determinant = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        reject = _mm_or_ps(reject, _mm_cmplt_ps(_mm_andnot_ps(signBit, determinant), smallest));
+        __m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&table.v0x[batch]));
+        __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&table.v0y[batch]));
+        __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&table.v0z[batch]));
+        __m128 beta = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDeterminant);
+        reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(beta, zero), _mm_cmpgt_ps(beta, one)));
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 gamma = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDeterminant);
+        reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(gamma, zero),
+            _mm_cmpgt_ps(_mm_add_ps(beta, gamma), one)));
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDeterminant);
+        reject = _mm_or_ps(reject, _mm_cmplt_ps(t, zero));
+
+        unsigned int lanes = ~_mm_movemask_ps(reject) & BatchLanes(first + count - batch, 4);
+        if (lanes == 0)
+            continue;
+        alignas(16) float tLanes[4], betaLanes[4], gammaLanes[4];
+        _mm_store_ps(tLanes, t);
+        _mm_store_ps(betaLanes, beta);
+        _mm_store_ps(gammaLanes, gamma);
+        found |= TakeClosestLanes(batch, lanes, tLanes, betaLanes, gammaLanes, hit);
+    }
+    return found;
+}
+
+static bool AnyHitSSE(const TriangleTable& table, const Ray& ray,
+    unsigned int first, unsigned int count, float tMin, float tMax) {
+    const __m128 dx = _mm_set1_ps(ray.direction_.x), dy = _mm_set1_ps(ray.direction_.y),
+        dz = _mm_set1_ps(ray.direction_.z);
+    const __m128 ox = _mm_set1_ps(ray.origin_.x), oy = _mm_set1_ps(ray.origin_.y),
+        oz = _mm_set1_ps(ray.origin_.z);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 smallest = _mm_set1_ps(std::numeric_limits<float>::min());
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 near = _mm_set1_ps(tMin), far = _mm_set1_ps(tMax);
+
+    for (unsigned int batch = first; batch < first + count; batch += 4) {
+        __m128 e1x = _mm_loadu_ps(&table.e1x[batch]), e1y = _mm_loadu_ps(&table.e1y[batch]),
+            e1z = _mm_loadu_ps(&table.e1z[batch]);
+        __m128 e2x = _mm_loadu_ps(&table.e2x[batch]), e2y = _mm_loadu_ps(&table.e2y[batch]),
+            e2z = _mm_loadu_ps(&table.e2z[batch]);
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 determinant = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 reject = _mm_cmplt_ps(_mm_andnot_ps(signBit, determinant), smallest);
+        __m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&table.v0x[batch]));
+        __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&table.v0y[batch]));
+        __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&table.v0z[batch]));
+        __m128 beta = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDeterminant);
+        reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(beta, zero), _mm_cmpgt_ps(beta, one)));
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 gamma = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDeterminant);
+        reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(gamma, zero),
+            _mm_cmpgt_ps(_mm_add_ps(beta, gamma), one)));
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDeterminant);
+        // this one accepts, a NaN distance blocks nothing
+        __m128 accept = _mm_andnot_ps(reject,
+            _mm_and_ps(_mm_cmpgt_ps(t, near), _mm_cmplt_ps(t, far)));
+
+        if (_mm_movemask_ps(accept) & BatchLanes(first + count - batch, 4))
+            return true;
+    }
+    return false;
+}
+
+// eight triangles at a time with AVX2. FMA is left out on purpose: fusing the
+// multiplies and adds would round differently from the other versions
+__attribute__((target("avx2")))
+static bool ClosestHitAVX2(const TriangleTable& table, const Ray& ray,
+    unsigned int first, unsigned int count, TriangleHit& hit) {
+    const __m256 dx = _mm256_set1_ps(ray.direction_.x), dy = _mm256_set1_ps(ray.direction_.y),
+        dz = _mm256_set1_ps(ray.direction_.z);
+    const __m256 ox = _mm256_set1_ps(ray.origin_.x), oy = _mm256_set1_ps(ray.origin_.y),
+        oz = _mm256_set1_ps(ray.origin_.z);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 epsilon = _mm256_set1_ps(EPSILON);
+    const __m256 smallest = _mm256_set1_ps(std::numeric_limits<float>::min());
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+    bool found = false;
+    for (unsigned int batch = first; batch < first + count; batch += 8) {
+        __m256 rayDotNormal = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(dx, _mm256_loadu_ps(&table.nx[batch])),
+            _mm256_mul_ps(dy, _mm256_loadu_ps(&table.ny[batch]))),
+            _mm256_mul_ps(dz, _mm256_loadu_ps(&table.nz[batch])));
+        __m256 reject = _mm256_cmp_ps(rayDotNormal, epsilon, _CMP_GT_OQ);
+
+        __m256 e1x = _mm256_loadu_ps(&table.e1x[batch]), e1y = _mm256_loadu_ps(&table.e1y[batch]),
+            e1z = _mm256_loadu_ps(&table.e1z[batch]);
+        __m256 e2x = _mm256_loadu_ps(&table.e2x[batch]), e2y = _mm256_loadu_ps(&table.e2y[batch]),
+            e2z = _mm256_loadu_ps(&table.e2z[batch]);
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 determinant = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        reject = _mm256_or_ps(reject, _mm256_cmp_ps(
+            _mm256_andnot_ps(signBit, determinant), smallest, _CMP_LT_OQ));
+        __m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+
+        __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&table.v0x[batch]));
+        __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&table.v0y[batch]));
+        __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&table.v0z[batch]));
+        __m256 beta = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)),
+            inverseDeterminant);
+        reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(beta, zero, _CMP_LT_OQ),
+            _mm256_cmp_ps(beta, one, _CMP_GT_OQ)));
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        __m256 gamma = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)),
+            inverseDeterminant);
+        reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(gamma, zero, _CMP_LT_OQ),
+            _mm256_cmp_ps(_mm256_add_ps(beta, gamma), one, _CMP_GT_OQ)));
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)),
+            inverseDeterminant);
+        reject = _mm256_or_ps(reject, _mm256_cmp_ps(t, zero, _CMP_LT_OQ));
+
+        unsigned int lanes = ~_mm256_movemask_ps(reject) & BatchLanes(first + count - batch, 8);
+        if (lanes == 0)
+            continue;
+        alignas(32) float tLanes[8], betaLanes[8], gammaLanes[8];
+        _mm256_store_ps(tLanes, t);
+        _mm256_store_ps(betaLanes, beta);
+        _mm256_store_ps(gammaLanes, gamma);
+        found |= TakeClosestLanes(batch, lanes, tLanes, betaLanes, gammaLanes, hit);
+    }
+    return found;
+}
+
+__attribute__((target("avx2")))
+static bool AnyHitAVX2(const TriangleTable& table, const Ray& ray,
+    unsigned int first, unsigned int count, float tMin, float tMax) {
+    const __m256 dx = _mm256_set1_ps(ray.direction_.x), dy = _mm256_set1_ps(ray.direction_.y),
+        dz = _mm256_set1_ps(ray.direction_.z);
+    const __m256 ox = _mm256_set1_ps(ray.origin_.x), oy = _mm256_set1_ps(ray.origin_.y),
+        oz = _mm256_set1_ps(ray.origin_.z);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 smallest = _mm256_set1_ps(std::numeric_limits<float>::min());
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 near = _mm256_set1_ps(tMin), far = _mm256_set1_ps(tMax);
+
+    for (unsigned int batch = first; batch < first + count; batch += 8) {
+        __m256 e1x = _mm256_loadu_ps(&table.e1x[batch]), e1y = _mm256_loadu_ps(&table.e1y[batch]),
+            e1z = _mm256_loadu_ps(&table.e1z[batch]);
+        __m256 e2x = _mm256_loadu_ps(&table.e2x[batch]), e2y = _mm256_loadu_ps(&table.e2y[batch]),
+            e2z = _mm256_loadu_ps(&table.e2z[batch]);
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 determinant = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+        __m256 reject = _mm256_cmp_ps(
+            _mm256_andnot_ps(signBit, determinant), smallest, _CMP_LT_OQ);
+        __m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+
+        __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&table.v0x[batch]));
+        __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&table.v0y[batch]));
+        __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&table.v0z[batch]));
+        __m256 beta = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)),
+            inverseDeterminant);
+        reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(beta, zero, _CMP_LT_OQ),
+            _mm256_cmp_ps(beta, one, _CMP_GT_OQ)));
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        __m256 gamma = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)),
+            inverseDeterminant);
+        reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(gamma, zero, _CMP_LT_OQ),
+            _mm256_cmp_ps(_mm256_add_ps(beta, gamma), one, _CMP_GT_OQ)));
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)),
+            inverseDeterminant);
+        // this one accepts, a NaN distance blocks nothing
+        __m256 accept = _mm256_andnot_ps(reject, _mm256_and_ps(
+            _mm256_cmp_ps(t, near, _CMP_GT_OQ), _mm256_cmp_ps(t, far, _CMP_LT_OQ)));
+
+        if (_mm256_movemask_ps(accept) & BatchLanes(first + count - batch, 8))
+            return true;
+    }
+    return false;
+}
+
+#endif
+
+// the versions of the tests picked for this machine
+struct TriangleKernels {
+    const char* name;
+    bool (*closestHit)(const TriangleTable&, const Ray&, unsigned int, unsigned int,
+        TriangleHit&);
+    bool (*anyHit)(const TriangleTable&, const Ray&, unsigned int, unsigned int,
+        float, float);
+};
+
+// the widest instruction set the processor running the program has, checked
+// once when the program starts
+static TriangleKernels SelectKernels() {
+#ifdef TRIANGLE_TABLE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return TriangleKernels{"avx2", ClosestHitAVX2, AnyHitAVX2};
+    return TriangleKernels{"sse", ClosestHitSSE, AnyHitSSE};
+#else
+    return TriangleKernels{"scalar", ClosestHitScalar, AnyHitScalar};
+#endif
+}
+
+static const TriangleKernels KERNELS = SelectKernels();
+
+bool TriangleTable::ClosestHit(const Ray& ray, unsigned int first, unsigned int count,
+    TriangleHit& hit) const {
+    return KERNELS.closestHit(*this, ray, first, count, hit);
+}
+
+bool TriangleTable::AnyHit(const Ray& ray, unsigned int first, unsigned int count,
+    float tMin, float tMax) const {
+    return KERNELS.anyHit(*this, ray, first, count, tMin, tMax);
+}
+
+const char* TriangleTable::KernelName() {
+    return KERNELS.name;
+}
@@ -0,0 +1,126 @@
+#ifndef TRIANGLETABLE_H
+#define TRIANGLETABLE_H
+
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Cartesian3.h"
+#include "Utils.h"
+
+// alignment of the triangle arrays, one cache line
+constexpr std::size_t TRIANGLE_TABLE_ALIGNMENT = 64;
+// the arrays are padded to a multiple of this many triangles, the widest batch
+// the intersection tests load, with room for a whole batch after any triangle
+constexpr unsigned int TRIANGLE_TABLE_PADDING = 8;
+
+// minimal allocator giving cache line aligned storage to std::vector
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t count) {
+        // aligned_alloc wants the size to be a multiple of the alignment
+        std::size_t size = (count * sizeof(T) + TRIANGLE_TABLE_ALIGNMENT - 1)
+            / TRIANGLE_TABLE_ALIGNMENT * TRIANGLE_TABLE_ALIGNMENT;
+        void* pointer = std::aligned_alloc(TRIANGLE_TABLE_ALIGNMENT, size);
+        if (pointer == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(pointer);
+    }
+    void deallocate(T* pointer, std::size_t) { std::free(pointer); }
+    // resizing leaves new elements uninitialised, as a plain array would, so a
+    // table that writes every element does not clear them first
+    template <typename U>
+    void construct(U* pointer) { ::new (static_cast<void*>(pointer)) U; }
+    template <typename U, typename... Args>
+    void construct(U* pointer, Args&&... args) {
+        ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float> > AlignedFloats;
+
+class ThreadPool;
+
+// the closest hit found so far by the table's intersection tests
+struct TriangleHit {
+    // distance along the ray
+    float t;
+    // the triangle hit and the barycentric weights of its second and third vertices
+    unsigned int tri;
+    float beta, gamma;
+};
+
+// a packed structure of arrays copy of the triangles, in the order the BVH
+// leaves reference them, with everything the intersection test needs
+// precomputed: the first vertex, the two edges leaving it and the unit normal
+class TriangleTable {
+    public:
+        TriangleTable() : size_(0) {}
+        ~TriangleTable() {}
+
+        // fill the table with the faces in the given order, on the pool's
+        // threads if there is one
+        void Build(const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces,
+            const std::vector<unsigned int>& order, ThreadPool* pool = nullptr);
+
+        // make room for size triangles plus the padding, all zero
+        void Resize(unsigned int size);
+
+        // length of the arrays of a table of size triangles
+        static unsigned int PaddedSize(unsigned int size);
+
+        // test the ray against the front faces of triangles [first, first + 
+        // count), replacing the hit if one is nearer than hit.t. Returns true
+        // if it was replaced
+        bool ClosestHit(const Ray& ray, unsigned int first, unsigned int count,
+            TriangleHit& hit) const;
+
+        // whether any of triangles [first, first + count) crosses the ray 
+        // strictly between tMin and tMax, from either side
+        bool AnyHit(const Ray& ray, unsigned int first, unsigned int count,
+            float tMin, float tMax) const;
+
+        // the instruction set the tests were picked for on this machine
+        static const char* KernelName();
+
+        // number of triangles, not counting the padding
+        unsigned int Size() const { return size_; }
+
+        // accessors to rebuild vectors from the arrays
+        Cartesian3 Vertex0(unsigned int tri) const {
+            return Cartesian3(v0x[tri], v0y[tri], v0z[tri]); }
+        Cartesian3 Edge1(unsigned int tri) const {
+            return Cartesian3(e1x[tri], e1y[tri], e1z[tri]); }
+        Cartesian3 Edge2(unsigned int tri) const {
+            return Cartesian3(e2x[tri], e2y[tri], e2z[tri]); }
+        Cartesian3 Normal(unsigned int tri) const {
+            return Cartesian3(nx[tri], ny[tri], nz[tri]); }
+
+    public:
+        // first vertex
+        AlignedFloats v0x, v0y, v0z;
+        // edges from the first vertex to the second and third
+        AlignedFloats e1x, e1y, e1z;
+        AlignedFloats e2x, e2y, e2z;
+        // unit geometric normal
+        AlignedFloats nx, ny, nz;
+        // index of the triangle in the object's faces
+        std::vector<unsigned int> face;
+
+    private:
+        unsigned int size_;
+};
+
+#endif
@@ -5,6 +5,10 @@
 #include "Matrix4.h"
 #include "RGBAValue.h"
 #include "math.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
 // a small constant 
 constexpr float EPSILON = 0.001;
@@ -41,6 +45,10 @@ class RGBRadiance {
         float RadianceAverage() const {
             return (red_ + green_ + blue_) / 3.0;
         }
+        // largest of the three components
+        float MaxComponent() const {
+            return std::max(red_, std::max(green_, blue_));
+        }
         // absolute value of radiance
         RGBRadiance absoluteRadiance() const {
             return RGBRadiance(abs(red_), abs(green_), abs(blue_));
@@ -71,6 +79,52 @@ class RGBRadiance {
         float red_, green_, blue_;
 };
 
+// a small PCG32 random number generator (O'Neill 2014). Each worker thread owns 
+// one and reseeds it for every pixel and sample, so the numbers a path gets 
+// do not depend on which thread traced it or in which order
+class RandomGenerator {
+    public:
+        RandomGenerator(uint64_t seed = 0) { Seed(seed); }
+
+        // restart the sequence from a seed
+        void Seed(uint64_t seed) {
+            state_ = 0;
+            NextUInt();
+            state_ += seed;
+            NextUInt();
+        }
+
+        // next 32 random bits
+        uint32_t NextUInt() {
+            uint64_t oldState = state_;
+            state_ = oldState * 6364136223846793005ULL + 1442695040888963407ULL;
+            uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+            uint32_t rotation = (uint32_t)(oldState >> 59u);
+            return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+        }
+
+        // uniform float in [0, 1), using the top 24 bits so it never rounds to 1
+        float NextFloat() {
+            return (NextUInt() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        // mix a render seed, a pixel index and a sample index into one seed
+        static uint64_t PixelSeed(uint64_t seed, uint64_t pixel, uint64_t sample) {
+            return Mix(Mix(Mix(seed) ^ pixel) ^ sample);
+        }
+
+    private:
+        // splitmix64 finaliser, spreads nearby inputs over all the bits
+        static uint64_t Mix(uint64_t value) {
+            value += 0x9e3779b97f4a7c15ULL;
+            value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+            return value ^ (value >> 31);
+        }
+
+        uint64_t state_;
+};
+
 // simple ray class 
 class Ray {
     public:
@@ -121,14 +175,46 @@ struct Light {
     bool atInfinity;
     // area light
     bool isAreaLight;
-    // the triangle that forms the area light
-    Triangle* triangle;
+    // index of the triangle in the object's faces that forms the area light
+    unsigned int triangle;
+    // the triangle's first vertex, the edges leaving it and its area, in object 
+    // space, cached once the object is read so sampling needs no lookups
+    Cartesian3 vertex0, edge1, edge2;
+    float area;
 };
 
 // a structure for representing a pixel
 struct Pixel {
     Cartesian3 worldPos;
+    // sum of the samples' radiance
     RGBRadiance radiance;
+    // set when the eye ray first hits an area light
+    bool isLight;
+    // samples taken, and the running mean and sum of squared differences from
+    // it (Welford) of their average radiance
+    unsigned int samples;
+    float mean, m2;
+
+    // add a sample to the sum and the running estimates
+    void AddSample(const RGBRadiance& sample) {
+        radiance = radiance + sample;
+        samples++;
+        float value = sample.RadianceAverage();
+        float delta = value - mean;
+        mean += delta / samples;
+        m2 += delta * (value - mean);
+    }
+
+    // standard error of the pixel's mean once gamma corrected, on the 0 to 1
+    // display scale. Display = radiance^GAMMA, so an error in the radiance 
+    // is scaled by the slope there, which stops growing once it saturates
+    float DisplayError() const {
+        if (samples < 2)
+            return std::numeric_limits<float>::max();
+        float standardError = std::sqrt(m2 / ((samples - 1.0f) * samples));
+        float slope = GAMMA * std::pow(std::min(std::max(mean, 0.0f), 1.0f), GAMMA - 1.0f);
+        return slope * standardError;
+    }
 };
 
 
@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+// the same switch as the triangle tests, so one define gives a scalar build
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(TRIANGLE_TABLE_SCALAR)
+#define WIDE_BVH_SIMD
+#include <immintrin.h>
+#endif
+
+#include "ThreadPool.h"
+#include "WideBVH.h"
+
+// smallest exponent the steps use, below it they would be denormal
+constexpr int WIDE_BVH_MIN_EXPONENT = -126;
+// largest quantized coordinate
+constexpr unsigned int WIDE_BVH_STEPS = 255;
+
+// size of the steps for an exponent, built straight from the exponent bits
+// where it is a normal float
+static inline float StepSize(int exponent) {
+    if ((exponent < WIDE_BVH_MIN_EXPONENT) || (exponent > 127))
+        return std::ldexp(1.0f, exponent);
+    uint32_t bits = (uint32_t) (exponent + 127) << 23;
+    float stepSize;
+    std::memcpy(&stepSize, &bits, sizeof(stepSize));
+    return stepSize;
+}
+
+// the step at or below a coordinate in steps, within the steps there are.
+// Truncation is the floor for the positive ones, without a call to floor
+static inline int FloorStep(float steps) {
+    if (steps >= (float) WIDE_BVH_STEPS)
+        return WIDE_BVH_STEPS;
+    return (steps > 0.0f) ? (int) steps : 0;
+}
+
+// the step at or above a coordinate in steps, within the steps there are
+static inline int CeilStep(float steps) {
+    if (steps >= (float) WIDE_BVH_STEPS)
+        return WIDE_BVH_STEPS;
+    if (!(steps > 0.0f))
+        return 0;
+    int step = (int) steps;
+    return ((float) step < steps) ? step + 1 : step;
+}
+
+// a quantized coordinate back in object space, computed as the box tests do
+static inline float Dequantize(float origin, unsigned int step, float stepSize) {
+    return origin + (float) step * stepSize;
+}
+
+AABB WideBVHNode::ChildBounds(unsigned int child) const {
+    AABB bounds;
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float stepSize = StepSize(exponent[axis]);
+        bounds.lower[axis] = Dequantize(origin[axis], lower[axis][child], stepSize);
+        bounds.upper[axis] = Dequantize(origin[axis], upper[axis][child], stepSize);
+    }
+    return bounds;
+}
+
+// collapse a binary hierarchy built over the faces. The top is collapsed on
+// this thread and the subtrees below it in parallel, then each subtree's part
+// goes after the top in a fixed order, so the layout does not depend on the
+// number of threads
+void WideBVH::Build(const BVH& binary, const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, ThreadPool* pool) {
+    nodes.clear();
+    primitives.clear();
+    if (binary.Empty())
+        return;
+
+    // the triangles under every binary node, children come after their parent
+    std::vector<unsigned int> counts(binary.nodes.size());
+    for (unsigned int nodeIndex = binary.nodes.size(); nodeIndex-- > 0; ) {
+        const BVHNode& node = binary.nodes[nodeIndex];
+        counts[nodeIndex] = node.IsLeaf() ? node.count :
+            counts[nodeIndex + 1] + counts[node.first];
+    }
+
+    std::vector<CollapseTask> tasks;
+    SourceNode root = FromBinary(binary, 0);
+    nodes.push_back(WideBVHNode());
+    if (counts[0] <= BVH_PARALLEL_THRESHOLD)
+        tasks.push_back(CollapseTask{root, 0});
+    else
+        Collapse(binary, vertices, faces, root, 0, nodes, primitives, &counts, &tasks);
+
+    // collapse the subtrees, the largest first so the last ones to finish are small
+    std::vector<unsigned int> order(tasks.size());
+    for (unsigned int task = 0; task < tasks.size(); task++)
+        order[task] = task;
+    auto taskCount = [&](unsigned int task) {
+        const SourceNode& source = tasks[task].source;
+        return (source.count != 0) ? source.count : counts[source.index];
+    };
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        return taskCount(a) > taskCount(b);
+    });
+    std::vector<CollapsedPart> parts(tasks.size());
+    std::atomic<unsigned int> nextTask(0);
+    RunSlices(pool, [&](unsigned int) {
+        for (unsigned int next = nextTask++; next < order.size(); next = nextTask++) {
+            CollapsedPart& part = parts[order[next]];
+            part.nodes.push_back(WideBVHNode());
+            Collapse(binary, vertices, faces, tasks[order[next]].source, 0,
+                part.nodes, part.primitives, nullptr, nullptr);
+        }
+    });
+
+    // the root of each part goes where the top left room for it and the rest
+    // after the top, so the part's indices move by where it starts
+    std::vector<unsigned int> nodeBases(tasks.size()), primitiveBases(tasks.size());
+    unsigned int nodeCount = nodes.size(), primitiveCount = primitives.size();
+    for (unsigned int task = 0; task < tasks.size(); task++) {
+        nodeBases[task] = nodeCount;
+        primitiveBases[task] = primitiveCount;
+        nodeCount += parts[task].nodes.size() - 1;
+        primitiveCount += parts[task].primitives.size();
+    }
+    nodes.resize(nodeCount);
+    primitives.resize(primitiveCount);
+    nextTask = 0;
+    RunSlices(pool, [&](unsigned int) {
+        for (unsigned int task = nextTask++; task < tasks.size(); task = nextTask++) {
+            const CollapsedPart& part = parts[task];
+            for (unsigned int nodeIndex = 0; nodeIndex < part.nodes.size(); nodeIndex++) {
+                WideBVHNode node = part.nodes[nodeIndex];
+                // children always come after the part's root
+                node.childBase += nodeBases[task] - 1;
+                node.primitiveBase += primitiveBases[task];
+                nodes[(nodeIndex == 0) ? tasks[task].nodeIndex :
+                    nodeBases[task] + nodeIndex - 1] = node;
+            }
+            std::copy(part.primitives.begin(), part.primitives.end(),
+                primitives.begin() + primitiveBases[task]);
+        }
+    });
+}
+
+// bounds of everything in the hierarchy, those of the root's children
+AABB WideBVH::Bounds() const {
+    AABB bounds;
+    if (nodes.empty())
+        return bounds;
+    for (unsigned int child = 0; child < WIDE_BVH_WIDTH; child++)
+        if ((nodes[0].innerMask & (1u << child)) || (nodes[0].triangleCount[child] != 0))
+            bounds.Extend(nodes[0].ChildBounds(child));
+    return bounds;
+}
+
+// the source node for a node of the binary hierarchy
+WideBVH::SourceNode WideBVH::FromBinary(const BVH& binary, unsigned int nodeIndex) {
+    const BVHNode& node = binary.nodes[nodeIndex];
+    SourceNode source;
+    source.bounds = node.bounds;
+    source.index = node.IsLeaf() ? node.first : nodeIndex;
+    source.count = node.count;
+    return source;
+}
+
+// the two halves of an interior source node
+void WideBVH::Split(const BVH& binary, const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, const SourceNode& source,
+    SourceNode& left, SourceNode& right) {
+    if (source.count == 0) {
+        // the first child directly follows its parent
+        left = FromBinary(binary, source.index + 1);
+        right = FromBinary(binary, binary.nodes[source.index].first);
+        return;
+    }
+
+    // only the depth limit makes leaves this large, and halving the run is as
+    // good as anything there
+    left.index = source.index;
+    left.count = source.count / 2;
+    right.index = source.index + left.count;
+    right.count = source.count - left.count;
+    for (SourceNode* half : { &left, &right }) {
+        half->bounds = AABB();
+        for (unsigned int prim = half->index; prim < half->index + half->count; prim++)
+            half->bounds.Extend(BVH::TriangleBounds(vertices, faces[binary.primitives[prim]]));
+    }
+}
+
+// fill in a wide node from the subtree, then its interior children, or leave
+// those with few enough triangles as tasks
+void WideBVH::Collapse(const BVH& binary, const std::vector<Cartesian3>& vertices,
+    const std::vector<Triangle>& faces, const SourceNode& source,
+    unsigned int nodeIndex, std::vector<WideBVHNode>& nodes,
+    std::vector<unsigned int>& primitives,
+    const std::vector<unsigned int>* counts, std::vector<CollapseTask>* tasks) {
+    // open up the subtree, always the interior child with the largest area as
+    // it is the one most likely to be hit, until the node is full. Each
+    // child's area is worked out once, when it is split off
+    SourceNode children[WIDE_BVH_WIDTH];
+    float areas[WIDE_BVH_WIDTH];
+    unsigned int childCount = 1;
+    children[0] = source;
+    areas[0] = source.bounds.SurfaceArea();
+    while (childCount < WIDE_BVH_WIDTH) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (unsigned int child = 0; child < childCount; child++)
+            if (IsInterior(children[child]) && (areas[child] > largestArea)) {
+                largest = child;
+                largestArea = areas[child];
+            }
+        if (largest < 0)
+            break;
+        SourceNode opened = children[largest];
+        Split(binary, vertices, faces, opened, children[largest], children[childCount]);
+        areas[largest] = children[largest].bounds.SurfaceArea();
+        areas[childCount] = children[childCount].bounds.SurfaceArea();
+        childCount++;
+    }
+
+    // the interior children get consecutive nodes, the leaves consecutive
+    // triangles, so the node only needs a base index for each
+    WideBVHNode node;
+    std::memset(&node, 0, sizeof(node));
+    node.childBase = nodes.size();
+    node.primitiveBase = primitives.size();
+    unsigned int innerCount = 0;
+    for (unsigned int child = 0; child < childCount; child++) {
+        if (IsInterior(children[child])) {
+            node.innerMask |= 1u << child;
+            node.childOffset[child] = innerCount++;
+            continue;
+        }
+        node.childOffset[child] = primitives.size() - node.primitiveBase;
+        node.triangleCount[child] = children[child].count;
+        primitives.insert(primitives.end(),
+            binary.primitives.begin() + children[child].index,
+            binary.primitives.begin() + children[child].index + children[child].count);
+    }
+    Quantize(node, children, childCount);
+    nodes.resize(nodes.size() + innerCount);
+    nodes[nodeIndex] = node;
+
+    for (unsigned int child = 0; child < childCount; child++) {
+        if (!(node.innerMask & (1u << child)))
+            continue;
+        unsigned int childIndex = node.childBase + node.childOffset[child];
+        const SourceNode& childSource = children[child];
+        if ((tasks != nullptr) && (((childSource.count != 0) ? childSource.count :
+            (*counts)[childSource.index]) <= BVH_PARALLEL_THRESHOLD))
+            tasks->push_back(CollapseTask{childSource, childIndex});
+        else
+            Collapse(binary, vertices, faces, childSource, childIndex, nodes, primitives,
+                counts, tasks);
+    }
+}
+
+// store the children's bounds relative to the node's. The rounding is checked
+// against the dequantized values, so the boxes never come out smaller
+void WideBVH::Quantize(WideBVHNode& node, const SourceNode* children,
+    unsigned int childCount) {
+    AABB bounds;
+    for (unsigned int child = 0; child < childCount; child++)
+        bounds.Extend(children[child].bounds);
+
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        float origin = bounds.lower[axis];
+        float extent = bounds.upper[axis] - origin;
+        // the smallest power of two that covers the extent in 255 steps
+        int exponent = WIDE_BVH_MIN_EXPONENT;
+        if (extent > 0.0f) {
+            std::frexp(extent / WIDE_BVH_STEPS, &exponent);
+            exponent = std::max(exponent, WIDE_BVH_MIN_EXPONENT);
+        }
+        while (Dequantize(origin, WIDE_BVH_STEPS, StepSize(exponent)) < bounds.upper[axis])
+            exponent++;
+        float stepSize = StepSize(exponent);
+        // dividing by a power of two is multiplying by its exact inverse
+        float inverseStep = StepSize(-exponent);
+        node.origin[axis] = origin;
+        node.exponent[axis] = exponent;
+
+        for (unsigned int child = 0; child < childCount; child++) {
+            float lower = children[child].bounds.lower[axis];
+            float upper = children[child].bounds.upper[axis];
+            int lowerStep = FloorStep((lower - origin) * inverseStep);
+            int upperStep = CeilStep((upper - origin) * inverseStep);
+            while ((lowerStep > 0) && (Dequantize(origin, lowerStep, stepSize) > lower))
+                lowerStep--;
+            while ((upperStep < (int) WIDE_BVH_STEPS) &&
+                (Dequantize(origin, upperStep, stepSize) < upper))
+                upperStep++;
+            node.lower[axis][child] = lowerStep;
+            node.upper[axis][child] = upperStep;
+        }
+    }
+}
+
+// the box tests below are the slab test of AABB::Intersect on the dequantized
+// boxes, with the same operations in the same order, so every version hits the
+// same children at the same distances
+
+#ifndef WIDE_BVH_SIMD
+
+// one child at a time, for machines without vector units
+static unsigned int IntersectChildrenScalar(const WideBVHNode& node, const Ray& ray,
+    const Cartesian3& invDir, float tMin, float tMax, float* tEntry) {
+    unsigned int hits = 0;
+    for (unsigned int child = 0; child < WIDE_BVH_WIDTH; child++) {
+        if (!(node.innerMask & (1u << child)) && (node.triangleCount[child] == 0))
+            continue;
+        if (node.ChildBounds(child).Intersect(ray, invDir, tMin, tMax, tEntry[child]))
+            hits |= 1u << child;
+    }
+    return hits;
+}
+
+#else
+
+// the children that are there, leaves have triangles and the rest are interior
+static inline unsigned int ChildMask(const WideBVHNode& node) {
+    __m128i counts = _mm_loadl_epi64((const __m128i*) node.triangleCount);
+    unsigned int empty = _mm_movemask_epi8(_mm_cmpeq_epi8(counts, _mm_setzero_si128()));
+    return (~empty & 0xff) | node.innerMask;
+}
+
+// the step size as a vector, built straight from the exponent bits
+static inline __m128 StepSizeSSE(int exponent) {
+    return _mm_castsi128_ps(_mm_set1_epi32((exponent + 127) << 23));
+}
+
+// four quantized coordinates as floats
+static inline __m128 LoadStepsSSE(const uint8_t* steps) {
+    int packed;
+    std::memcpy(&packed, steps, sizeof(packed));
+    __m128i bytes = _mm_cvtsi32_si128(packed);
+    __m128i words = _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, _mm_setzero_si128()));
+}
+
+// the children in two halves of four with SSE. The minimum and maximum keep
+// their second operand on a NaN, as the comparisons of the scalar test do
+static unsigned int IntersectChildrenSSE(const WideBVHNode& node, const Ray& ray,
+    const Cartesian3& invDir, float tMin, float tMax, float* tEntry) {
+    unsigned int hits = 0;
+    for (unsigned int half = 0; half < WIDE_BVH_WIDTH; half += 4) {
+        __m128 near = _mm_set1_ps(tMin), far = _mm_set1_ps(tMax);
+        for (unsigned int axis = 0; axis < 3; axis++) {
+            __m128 origin = _mm_set1_ps(node.origin[axis]);
+            __m128 stepSize = StepSizeSSE(node.exponent[axis]);
+            __m128 lower = _mm_add_ps(origin,
+                _mm_mul_ps(LoadStepsSSE(&node.lower[axis][half]), stepSize));
+            __m128 upper = _mm_add_ps(origin,
+                _mm_mul_ps(LoadStepsSSE(&node.upper[axis][half]), stepSize));
+            __m128 rayOrigin = _mm_set1_ps(ray.origin_[axis]);
+            __m128 inverse = _mm_set1_ps(invDir[axis]);
+            __m128 tNear = _mm_mul_ps(_mm_sub_ps(lower, rayOrigin), inverse);
+            __m128 tFar = _mm_mul_ps(_mm_sub_ps(upper, rayOrigin), inverse);
+            near = _mm_max_ps(_mm_min_ps(tFar, tNear), near);
+            far = _mm_min_ps(_mm_max_ps(tNear, tFar), far);
+        }
+        hits |= (~_mm_movemask_ps(_mm_cmpgt_ps(near, far)) & 0xf) << half;
+        _mm_storeu_ps(tEntry + half, near);
+    }
+    return hits & ChildMask(node);
+}
+
+// all eight children at once with AVX2
+__attribute__((target("avx2")))
+static unsigned int IntersectChildrenAVX2(const WideBVHNode& node, const Ray& ray,
+    const Cartesian3& invDir, float tMin, float tMax, float* tEntry) {
+    __m256 near = _mm256_set1_ps(tMin), far = _mm256_set1_ps(tMax);
+    for (unsigned int axis = 0; axis < 3; axis++) {
+        __m256 origin = _mm256_set1_ps(node.origin[axis]);
+        __m256 stepSize = _mm256_castsi256_ps(
+            _mm256_set1_epi32((node.exponent[axis] + 127) << 23));
+        __m256 lower = _mm256_add_ps(origin, _mm256_mul_ps(_mm256_cvtepi32_ps(
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) node.lower[axis]))),
+            stepSize));
+        __m256 upper = _mm256_add_ps(origin, _mm256_mul_ps(_mm256_cvtepi32_ps(
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) node.upper[axis]))),
+            stepSize));
+        __m256 rayOrigin = _mm256_set1_ps(ray.origin_[axis]);
+        __m256 inverse = _mm256_set1_ps(invDir[axis]);
+        __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(lower, rayOrigin), inverse);
+        __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(upper, rayOrigin), inverse);
+        near = _mm256_max_ps(_mm256_min_ps(tFar, tNear), near);
+        far = _mm256_min_ps(_mm256_max_ps(tNear, tFar), far);
+    }
+    _mm256_storeu_ps(tEntry, near);
+    unsigned int hits = ~_mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_GT_OQ)) & 0xff;
+    return hits & ChildMask(node);
+}
+
+#endif
+
+typedef unsigned int (*ChildrenTest)(const WideBVHNode&, const Ray&, const Cartesian3&,
+    float, float, float*);
+
+// the widest box test the processor running the program has
+static ChildrenTest SelectChildrenTest() {
+#ifdef WIDE_BVH_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return IntersectChildrenAVX2;
+    return IntersectChildrenSSE;
+#else
+    return IntersectChildrenScalar;
+#endif
+}
+
+static const ChildrenTest CHILDREN_TEST = SelectChildrenTest();
+
+unsigned int WideBVH::IntersectChildren(const WideBVHNode& node, const Ray& ray,
+    const Cartesian3& invDir, float tMin, float tMax, float* tEntry) {
+    return CHILDREN_TEST(node, ray, invDir, tMin, tMax, tEntry);
+}
@@ -0,0 +1,137 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+// children per node of the wide hierarchy, one per lane of the box tests
+constexpr unsigned int WIDE_BVH_WIDTH = 8;
+// leaf children hold at most this many triangles, larger binary leaves are cut
+constexpr unsigned int WIDE_BVH_MAX_LEAF_SIZE = 8;
+// the wide hierarchy is never deeper than the binary one, plus the levels
+// cutting up its largest leaf can add
+constexpr unsigned int WIDE_BVH_MAX_DEPTH = BVH_MAX_DEPTH + 32;
+// each node visited leaves at most all but one of its children on the stack
+constexpr unsigned int WIDE_BVH_STACK_SIZE =
+    (WIDE_BVH_WIDTH - 1) * WIDE_BVH_MAX_DEPTH + 1;
+
+// a node of the wide hierarchy (88 bytes). The child boxes are stored in 8 bits
+// per plane as steps of a power of two from the node's lower corner, rounded
+// outwards so they always contain what they bound
+struct WideBVHNode {
+    // lower corner of the node's bounds
+    float origin[3];
+    // the steps along each axis are 2^exponent
+    int8_t exponent[3];
+    // bit i is set if child i is an interior node
+    uint8_t innerMask;
+    // the interior children are consecutive nodes from this one
+    uint32_t childBase;
+    // the triangles of the leaf children are consecutive from this one
+    uint32_t primitiveBase;
+    // quantized child bounds, per axis then per child
+    uint8_t lower[3][WIDE_BVH_WIDTH];
+    uint8_t upper[3][WIDE_BVH_WIDTH];
+    // interior children: offset from childBase, leaves: offset from primitiveBase
+    uint8_t childOffset[WIDE_BVH_WIDTH];
+    // triangles in each leaf child, 0 for interior and empty children
+    uint8_t triangleCount[WIDE_BVH_WIDTH];
+
+    // the decoded bounds of a child, as the box tests see them
+    AABB ChildBounds(unsigned int child) const;
+};
+
+// a child still to be visited on a traversal stack
+struct WideBVHEntry {
+    // interior nodes: the node, leaves: the first triangle in the table
+    unsigned int index;
+    // number of triangles in a leaf, 0 for interior nodes
+    unsigned int count;
+    // distance the ray enters the child's box at
+    float tEntry;
+};
+
+// an 8 wide bounding volume hierarchy collapsed from a binary one, so a ray
+// tests eight boxes at once and visits far fewer, smaller nodes
+class WideBVH {
+    public:
+        WideBVH() {}
+        ~WideBVH() {}
+
+        // collapse a binary hierarchy built over the faces, on the pool's
+        // threads if there is one
+        void Build(const BVH& binary, const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, ThreadPool* pool = nullptr);
+
+        bool Empty() const { return nodes.empty(); }
+
+        // bounds of everything in the hierarchy, as the box tests see them
+        AABB Bounds() const;
+
+        // test the ray against the boxes of a node's children, clipped to
+        // [tMin, tMax]. Returns a mask of the children hit, with the distance
+        // each one is entered at in tEntry
+        static unsigned int IntersectChildren(const WideBVHNode& node, const Ray& ray,
+            const Cartesian3& invDir, float tMin, float tMax, float* tEntry);
+
+    private:
+        // a subtree of the binary hierarchy while it is being collapsed, either
+        // an interior node or a run of a leaf's triangles
+        struct SourceNode {
+            AABB bounds;
+            // interior nodes: the binary node, leaves: the first primitive
+            unsigned int index;
+            // number of triangles in a leaf, 0 for interior nodes
+            unsigned int count;
+        };
+
+        // a subtree left by the top of the collapse for a thread to collapse
+        // on its own, into the node the top left for its root
+        struct CollapseTask {
+            SourceNode source;
+            unsigned int nodeIndex;
+        };
+
+        // the nodes and triangles a task collapsed its subtree into, its
+        // root is node 0 and the indices count from the start of the part
+        struct CollapsedPart {
+            std::vector<WideBVHNode> nodes;
+            std::vector<unsigned int> primitives;
+        };
+
+        // whether a source node has to be opened up to fit in a wide node
+        static bool IsInterior(const SourceNode& source) {
+            return (source.count == 0) || (source.count > WIDE_BVH_MAX_LEAF_SIZE); }
+
+        // the source node for a node of the binary hierarchy
+        static SourceNode FromBinary(const BVH& binary, unsigned int nodeIndex);
+
+        // the two halves of an interior source node, a leaf too large to keep
+        // is cut in the middle of its run of triangles
+        static void Split(const BVH& binary, const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, const SourceNode& source,
+            SourceNode& left, SourceNode& right);
+
+        // fill in a wide node from the subtree, then its interior children.
+        // With tasks, given the triangles under each binary node in counts,
+        // interior children with few enough triangles are left as tasks
+        static void Collapse(const BVH& binary, const std::vector<Cartesian3>& vertices,
+            const std::vector<Triangle>& faces, const SourceNode& source,
+            unsigned int nodeIndex, std::vector<WideBVHNode>& nodes,
+            std::vector<unsigned int>& primitives,
+            const std::vector<unsigned int>* counts, std::vector<CollapseTask>* tasks);
+
+        // store the children's bounds relative to the node's
+        static void Quantize(WideBVHNode& node, const SourceNode* children,
+            unsigned int childCount);
+
+    public:
+        // the nodes, the root is node 0
+        std::vector<WideBVHNode> nodes;
+        // the indices of the triangles in the object's faces, in leaf order
+        std::vector<unsigned int> primitives;
+};
+
+#endif
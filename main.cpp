@@ -27,6 +27,7 @@
 #include "TexturedObject.h"
 #include "RenderParameters.h"
 #include "RenderController.h"
+#include "SceneCache.h"
 
 // main routine
 int main(int argc, char **argv)
@@ -35,10 +36,10 @@ int main(int argc, char **argv)
     QApplication renderApp(argc, argv);
 
     // check the args to make sure there's an input file
-    if (argc != 3) 
+    if ((argc != 3) && (argc != 4))
         { // bad arg count
         // print an error message
-        std::cout << "Usage: " << argv[0] << " geometry texture" << std::endl; 
+        std::cout << "Usage: " << argv[0] << " geometry texture [cache]" << std::endl; 
         // and leave
         return 0;
         } // bad arg count
@@ -46,16 +47,21 @@ int main(int argc, char **argv)
     //  use the argument to create a height field &c.
     TexturedObject texturedObject;
 
-    // open the input files for the geometry & texture
-    std::ifstream geometryFile(argv[1]);
+    // open the texture file, the geometry file is mapped by the reader
     std::ifstream textureFile(argv[2]);
 
-    // try reading it
-    if (!(geometryFile.good()) || !(textureFile.good()) || (!texturedObject.ReadObjectStream(geometryFile, textureFile)))
+    // an up to date scene cache saves reading and building everything again
+    if ((argc == 4) && LoadSceneCache(texturedObject, argv[1], argv[3]))
+        std::cout << "Read scene cache " << argv[3] << std::endl;
+    // otherwise try reading it
+    else if (!(textureFile.good()) || (!texturedObject.ReadObjectFile(argv[1], textureFile)))
         { // object read failed 
         std::cout << "Read failed for object " << argv[1] << " or texture " << argv[2] << std::endl;
         return 0;
         } // object read failed
+    // and keep it for the next run
+    else if ((argc == 4) && !SaveSceneCache(texturedObject, argv[1], argv[3]))
+        std::cout << "Could not write scene cache " << argv[3] << std::endl;
 
     // dump the file to out
 //      texturedObject.WriteObjectStream(std::cout, std::cout);